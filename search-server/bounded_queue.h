@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Multi-producer multi-consumer FIFO queue of at most capacity values.
+// Push blocks while the queue is full, which pushes back on producers;
+// Pop blocks while it is empty. After Close pushes fail and pops drain the
+// values left.
+template <typename T>
+class BoundedQueue {
+   public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    // Returns false if the queue is closed.
+    bool Push(T value) {
+        std::unique_lock lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || values_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        values_.push_back(std::move(value));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Returns false without taking the value if the queue is full or closed.
+    bool TryPush(T& value) {
+        std::lock_guard guard(mutex_);
+        if (closed_ || values_.size() == capacity_) {
+            return false;
+        }
+        values_.push_back(std::move(value));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Puts back a value taken with Pop, regardless of the capacity and of
+    // Close, so work already admitted is never lost.
+    void Requeue(T value) {
+        std::lock_guard guard(mutex_);
+        values_.push_back(std::move(value));
+        not_empty_.notify_one();
+    }
+
+    // Returns nullopt once the queue is closed and empty.
+    std::optional<T> Pop() {
+        std::unique_lock lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !values_.empty(); });
+        if (values_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(values_.front());
+        values_.pop_front();
+        not_full_.notify_one();
+        return value;
+    }
+
+    void Close() {
+        std::lock_guard guard(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    const size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> values_;
+    bool closed_ = false;
+};
@@ -0,0 +1,51 @@
+#include "crc32.h"
+
+#include <array>
+#include <cstring>
+
+using namespace std;
+
+uint32_t ComputeCrc32(string_view data, uint32_t crc) {
+    // Slicing by 8: tables[k][b] is the CRC of byte b followed by k zero
+    // bytes, so eight bytes are folded in with eight independent lookups.
+    static const auto tables = [] {
+        array<array<uint32_t, 256>, 8> tables{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+            tables[0][i] = value;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t k = 1; k < tables.size(); ++k) {
+                tables[k][i] = tables[0][tables[k - 1][i] & 0xFF] ^ (tables[k - 1][i] >> 8);
+            }
+        }
+        return tables;
+    }();
+
+    crc ^= 0xFFFFFFFFu;
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    size_t size = data.size();
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, bytes, sizeof(low));
+        memcpy(&high, bytes + 4, sizeof(high));
+        // The words are read in little-endian order.
+        if constexpr (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) {
+            low = __builtin_bswap32(low);
+            high = __builtin_bswap32(high);
+        }
+        low ^= crc;
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^
+              tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+              tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^
+              tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+    }
+    for (; size > 0; ++bytes, --size) {
+        crc = tables[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// CRC-32 (IEEE 802.3) of the data. Passing the result for earlier data as
+// crc continues the checksum over data that comes in pieces.
+uint32_t ComputeCrc32(std::string_view data, uint32_t crc = 0);
@@ -0,0 +1,32 @@
+#include "file_sync.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+void SyncPath(const string& path, int flags) {
+    const int descriptor = open(path.c_str(), flags);
+    const bool synced = descriptor >= 0 && fsync(descriptor) == 0;
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+    if (!synced) {
+        throw runtime_error("cannot sync " + path);
+    }
+}
+
+}  // namespace
+
+void SyncFile(const string& path) { SyncPath(path, O_RDONLY); }
+
+void SyncParentDirectory(const string& path) {
+    const size_t slash = path.rfind('/');
+    const string directory =
+        slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    SyncPath(directory, O_RDONLY | O_DIRECTORY);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+// Flushes the file at the path to disk. Throws std::runtime_error if it
+// cannot be opened or synced.
+void SyncFile(const std::string& path);
+
+// Flushes the directory holding the path, which makes creating, renaming
+// or removing the path itself durable. Throws as SyncFile.
+void SyncParentDirectory(const std::string& path);
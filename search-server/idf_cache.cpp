@@ -0,0 +1,10 @@
+#include "idf_cache.h"
+
+using namespace std;
+
+void IdfCache::Grow(size_t size) {
+    unique_lock lock(mutex_);
+    while (entries_.size() < size) {
+        entries_.emplace_back();
+    }
+}
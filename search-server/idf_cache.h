@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+
+// Value computed from index statistics, remembered together with the index
+// epoch it is valid for. An entry only moves to later epochs, so a query on
+// an older snapshot computes its value without storing it. A writer parks
+// the entry while it stores the value, and a reader checks the epoch again
+// after reading, so it never takes the value of one epoch for another.
+class EpochCachedValue {
+   public:
+    template <typename Compute>
+    double Get(uint64_t epoch, Compute compute) const {
+        const uint64_t tag = epoch + 1;
+        if (tag_.load(std::memory_order_acquire) == tag) {
+            const double value = value_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (tag_.load(std::memory_order_relaxed) == tag) {
+                return value;
+            }
+        }
+
+        const double value = compute();
+        uint64_t cached = tag_.load(std::memory_order_relaxed);
+        if (cached < tag &&
+            tag_.compare_exchange_strong(cached, STORING, std::memory_order_relaxed)) {
+            std::atomic_thread_fence(std::memory_order_release);
+            value_.store(value, std::memory_order_relaxed);
+            tag_.store(tag, std::memory_order_release);
+        }
+        return value;
+    }
+
+   private:
+    static constexpr uint64_t STORING = std::numeric_limits<uint64_t>::max();
+
+    // The epoch plus one, so that zero means empty.
+    mutable std::atomic<uint64_t> tag_{0};
+    mutable std::atomic<double> value_{0.0};
+};
+
+// Inverse document frequencies by term id, each cached for the latest epoch
+// it was asked for. Snapshots of one epoch have the same IDFs, since merges
+// do not change them, so they share the values. Safe to use from several
+// threads: entries are added under an exclusive lock as new terms are
+// looked up and read under a shared one.
+class IdfCache {
+   public:
+    template <typename Compute>
+    double Get(int term_id, uint64_t epoch, Compute compute) {
+        const auto index = static_cast<size_t>(term_id);
+        std::shared_lock lock(mutex_);
+        if (index >= entries_.size()) {
+            lock.unlock();
+            Grow(index + 1);
+            lock.lock();
+        }
+        return entries_[index].Get(epoch, compute);
+    }
+
+   private:
+    std::shared_mutex mutex_;
+    // A deque keeps the entries in place as it grows.
+    std::deque<EpochCachedValue> entries_;
+
+    void Grow(size_t size);
+};
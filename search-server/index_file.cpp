@@ -0,0 +1,370 @@
+#include "index_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "crc32.h"
+#include "file_sync.h"
+#include "posting_list.h"
+
+using namespace std;
+
+namespace {
+
+const char INDEX_FILE_MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+const size_t INDEX_FILE_ALIGNMENT = 8;
+
+static_assert(sizeof(PostingList::BlockBound) % INDEX_FILE_ALIGNMENT == 0);
+static_assert(sizeof(DocumentStatus) == sizeof(int32_t));
+
+size_t Align(size_t size) {
+    return (size + INDEX_FILE_ALIGNMENT - 1) / INDEX_FILE_ALIGNMENT * INDEX_FILE_ALIGNMENT;
+}
+
+// Writes a temporary file next to the path and renames it over the path in
+// Finish, so the previous file stays intact until the new one is complete.
+// That matters twice: a crash mid-write leaves the old index, and a server
+// opened from the old file keeps reading its mapped pages, which belong to
+// the replaced inode.
+class IndexFileWriter {
+   public:
+    explicit IndexFileWriter(const string& path)
+        : path_(path),
+          temporary_path_(path + ".tmp"),
+          output_(temporary_path_, ios::binary | ios::trunc) {
+        if (!output_) {
+            throw runtime_error("cannot create index file " + temporary_path_);
+        }
+    }
+
+    ~IndexFileWriter() {
+        if (!finished_) {
+            output_.close();
+            remove(temporary_path_.c_str());
+        }
+    }
+
+    template <typename T>
+    void WriteValue(const T& value) {
+        WriteBytes(&value, sizeof(value));
+    }
+
+    template <typename T>
+    void WriteArray(ArrayView<T> values) {
+        WriteValue(static_cast<uint64_t>(values.size()));
+        WriteBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void WriteString(string_view text) { WriteArray(ArrayView<char>(text.data(), text.size())); }
+
+    void Finish() {
+        const uint32_t crc = crc_;
+        WriteValue(crc);
+        output_.close();
+        if (!output_) {
+            throw runtime_error("cannot write index file " + temporary_path_);
+        }
+        SyncFile(temporary_path_);
+
+        if (rename(temporary_path_.c_str(), path_.c_str()) != 0) {
+            throw runtime_error("cannot replace index file " + path_);
+        }
+        finished_ = true;
+        // Makes the rename itself durable.
+        SyncParentDirectory(path_);
+    }
+
+   private:
+    string path_;
+    string temporary_path_;
+    ofstream output_;
+    uint32_t crc_ = 0;
+    bool finished_ = false;
+
+    void WriteBytes(const void* data, size_t size) {
+        static const char padding[INDEX_FILE_ALIGNMENT] = {};
+        const string_view bytes(static_cast<const char*>(data), size);
+        const string_view padding_bytes(padding, Align(size) - size);
+        output_.write(bytes.data(), bytes.size());
+        output_.write(padding_bytes.data(), padding_bytes.size());
+        crc_ = ComputeCrc32(padding_bytes, ComputeCrc32(bytes, crc_));
+    }
+};
+
+class IndexFileReader {
+   public:
+    IndexFileReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    template <typename T>
+    T ReadValue() {
+        return Take<T>(1)[0];
+    }
+
+    template <typename T>
+    ArrayView<T> ReadArray() {
+        return Take<T>(ReadValue<uint64_t>());
+    }
+
+    string_view ReadString() {
+        const auto chars = ReadArray<char>();
+        return {chars.data(), chars.size()};
+    }
+
+    // Stops reading at the given size, which leaves a trailer unread.
+    void SetEnd(size_t size) {
+        size_ = min(size_, size);
+        position_ = min(position_, size_);
+    }
+
+    // Reads the count of items that each take at least min_size bytes of
+    // the rest of the file, so a corrupted count cannot make the caller
+    // allocate more than the file size.
+    uint64_t ReadCount(size_t min_size) {
+        const auto count = ReadValue<uint64_t>();
+        if (count > (size_ - position_) / min_size) {
+            throw runtime_error("index file is truncated");
+        }
+        return count;
+    }
+
+   private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_ = 0;
+
+    template <typename T>
+    ArrayView<T> Take(uint64_t count) {
+        if (count > (size_ - position_) / sizeof(T)) {
+            throw runtime_error("index file is truncated");
+        }
+        ArrayView<T> items(reinterpret_cast<const T*>(data_ + position_), count);
+        position_ = min(size_, position_ + Align(count * sizeof(T)));
+        return items;
+    }
+};
+
+// What the segment of an index file keeps alive besides the mapping.
+struct MappedSegment {
+    shared_ptr<const void> file;
+    vector<int> posting_terms;
+    vector<PostingList> posting_lists;
+    optional<PostingListChecks> posting_checks;
+    vector<shared_ptr<const DocumentWordFrequencies>> word_frequencies;
+};
+
+shared_ptr<const void> MapFile(const string& path, size_t& size) {
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw runtime_error("cannot open index file " + path);
+    }
+
+    struct stat status;
+    void* data = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        size = static_cast<size_t>(status.st_size);
+        data = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+    }
+    close(descriptor);
+
+    if (data == MAP_FAILED) {
+        throw runtime_error("cannot map index file " + path);
+    }
+    return shared_ptr<const void>(data, [size](const void* data) {
+        munmap(const_cast<void*>(data), size);
+    });
+}
+
+}  // namespace
+
+void WriteIndexFile(const string& path, uint64_t log_sequence, const vector<string_view>& stop_words,
+                    const vector<string_view>& terms, const IndexSegment& segment) {
+    IndexFileWriter writer(path);
+
+    writer.WriteValue(INDEX_FILE_MAGIC);
+    writer.WriteValue(INDEX_FILE_VERSION);
+    writer.WriteValue(uint32_t{0});
+    writer.WriteValue(log_sequence);
+
+    for (const auto* words : {&stop_words, &terms}) {
+        writer.WriteValue(static_cast<uint64_t>(words->size()));
+        for (string_view word : *words) {
+            writer.WriteString(word);
+        }
+    }
+
+    writer.WriteValue(static_cast<uint64_t>(segment.GetDocumentCount()));
+    writer.WriteArray<int>(segment.document_ids);
+    writer.WriteArray<int>(segment.document_ratings);
+    writer.WriteArray<DocumentStatus>(segment.document_status);
+    writer.WriteArray<int>(segment.document_lengths);
+    writer.WriteArray<size_t>(segment.forward_offsets);
+    writer.WriteArray<int>(segment.forward_terms);
+    writer.WriteArray<uint32_t>(segment.forward_counts);
+
+    uint64_t term_count = 0;
+    segment.ForEachPostings([&term_count](int, const PostingList::Image&) { ++term_count; });
+    writer.WriteValue(term_count);
+    segment.ForEachPostings([&writer](int term_id, const PostingList::Image& image) {
+        writer.WriteValue(static_cast<int64_t>(term_id));
+        writer.WriteValue(static_cast<uint64_t>(image.size));
+        writer.WriteValue(image.max_term_freq);
+        writer.WriteArray(image.data);
+        writer.WriteArray(image.block_offsets);
+        writer.WriteArray(image.blocks);
+        writer.WriteArray(image.tail_ordinals);
+        writer.WriteArray(image.tail_counts);
+    });
+
+    writer.Finish();
+}
+
+IndexFileContents ReadIndexFile(const string& path) {
+    IndexFileContents contents;
+    size_t size = 0;
+    contents.storage = MapFile(path, size);
+    const auto* data = static_cast<const uint8_t*>(contents.storage.get());
+    IndexFileReader reader(data, size);
+
+    const auto magic = reader.ReadValue<array<char, sizeof(INDEX_FILE_MAGIC)>>();
+    if (memcmp(magic.data(), INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) != 0) {
+        throw runtime_error(path + " is not an index file");
+    }
+    if (reader.ReadValue<uint32_t>() != INDEX_FILE_VERSION) {
+        throw runtime_error("unsupported index file version in " + path);
+    }
+    // The checksum and its zero padding end the file; the rest is read only
+    // once it matches.
+    uint32_t crc[INDEX_FILE_ALIGNMENT / sizeof(uint32_t)];
+    if (size < sizeof(crc)) {
+        throw runtime_error("index file is truncated");
+    }
+    size -= sizeof(crc);
+    memcpy(crc, data + size, sizeof(crc));
+    if (ComputeCrc32({reinterpret_cast<const char*>(data), size}) != crc[0] || crc[1] != 0) {
+        throw runtime_error("index file is corrupted");
+    }
+    reader.SetEnd(size);
+    reader.ReadValue<uint32_t>();
+    contents.log_sequence = reader.ReadValue<uint64_t>();
+
+    for (auto* words : {&contents.stop_words, &contents.terms}) {
+        words->resize(reader.ReadCount(sizeof(uint64_t)));
+        for (string_view& word : *words) {
+            word = reader.ReadString();
+        }
+    }
+    const auto term_limit = static_cast<int64_t>(contents.terms.size());
+
+    // The columns and the forward index are used in place as well.
+    const auto document_count = reader.ReadCount(sizeof(int));
+    if (document_count > static_cast<uint64_t>(numeric_limits<int>::max())) {
+        throw runtime_error("index file is corrupted");
+    }
+    auto storage = make_shared<MappedSegment>();
+    storage->file = contents.storage;
+    auto segment = make_shared<IndexSegment>();
+    const auto read_column = [&reader](auto& column, uint64_t expected_size) {
+        using T = typename decay_t<decltype(column)>::value_type;
+        column = reader.ReadArray<T>();
+        if (column.size() != expected_size) {
+            throw runtime_error("index file is corrupted");
+        }
+    };
+    read_column(segment->document_ids, document_count);
+    read_column(segment->document_ratings, document_count);
+    read_column(segment->document_status, document_count);
+    read_column(segment->document_lengths, document_count);
+    read_column(segment->forward_offsets, document_count + 1);
+    const auto forward_size = segment->forward_offsets.back();
+    read_column(segment->forward_terms, forward_size);
+    read_column(segment->forward_counts, forward_size);
+
+    // Every document: a unique id, a known status, forward offsets that
+    // start at zero and do not decrease, and strictly increasing term ids
+    // of the dictionary with nonzero counts that add up to its length.
+    if (segment->forward_offsets[0] != 0) {
+        throw runtime_error("index file is corrupted");
+    }
+    unordered_set<int> document_ids;
+    document_ids.reserve(document_count);
+    for (int ordinal = 0; ordinal < static_cast<int>(document_count); ++ordinal) {
+        const size_t begin = segment->forward_offsets[ordinal];
+        const size_t end = segment->forward_offsets[ordinal + 1];
+        const int status = segment->document_status[ordinal];
+        if (segment->document_ids[ordinal] < 0 || status < DocumentStatus::ACTUAL ||
+            status > DocumentStatus::REMOVED || begin > end ||
+            !document_ids.insert(segment->document_ids[ordinal]).second) {
+            throw runtime_error("index file is corrupted");
+        }
+        // Summed in 64 bits, so crafted counts cannot overflow.
+        int64_t length = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const int term_id = segment->forward_terms[i];
+            if (term_id < 0 || term_id >= term_limit ||
+                (i > begin && term_id <= segment->forward_terms[i - 1]) ||
+                segment->forward_counts[i] == 0) {
+                throw runtime_error("index file is corrupted");
+            }
+            length += segment->forward_counts[i];
+        }
+        if (length != segment->document_lengths[ordinal]) {
+            throw runtime_error("index file is corrupted");
+        }
+        storage->word_frequencies.push_back(make_shared<const DocumentWordFrequencies>());
+    }
+
+    // Every posting list: a term id in increasing order and arrays within the
+    // file. The postings add up to the forward index entries; that each list
+    // decodes to postings the forward index lists is checked on first use.
+    const auto term_count = reader.ReadCount(sizeof(int64_t));
+    storage->posting_terms.reserve(term_count);
+    storage->posting_lists.reserve(term_count);
+    uint64_t posting_count = 0;
+    int64_t previous_term_id = -1;
+    for (uint64_t i = 0; i < term_count; ++i) {
+        const auto term_id = reader.ReadValue<int64_t>();
+        if (term_id <= previous_term_id || term_id >= term_limit) {
+            throw runtime_error("index file is corrupted");
+        }
+        previous_term_id = term_id;
+        PostingList::Image image;
+        image.size = reader.ReadValue<uint64_t>();
+        image.max_term_freq = reader.ReadValue<double>();
+        image.data = reader.ReadArray<uint8_t>();
+        image.block_offsets = reader.ReadArray<uint32_t>();
+        image.blocks = reader.ReadArray<PostingList::BlockBound>();
+        image.tail_ordinals = reader.ReadArray<int>();
+        image.tail_counts = reader.ReadArray<uint32_t>();
+        // Bounded by the forward index, so the total cannot overflow.
+        if (image.size == 0 || image.size > forward_size - posting_count) {
+            throw runtime_error("index file is corrupted");
+        }
+        storage->posting_terms.push_back(static_cast<int>(term_id));
+        storage->posting_lists.emplace_back(image);
+        posting_count += image.size;
+    }
+    if (posting_count != forward_size) {
+        throw runtime_error("index file is corrupted");
+    }
+    storage->posting_checks.emplace(term_count);
+
+    segment->word_frequencies = storage->word_frequencies;
+    segment->posting_terms = storage->posting_terms;
+    segment->posting_lists = storage->posting_lists;
+    segment->posting_checks = &*storage->posting_checks;
+    segment->storage = move(storage);
+    contents.segment = move(segment);
+    return contents;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "array_view.h"
+#include "index_segment.h"
+
+// Binary image of an index: the stop words, the term dictionary and one
+// segment. It is written in native byte order and every array is padded to
+// 8 bytes, so the posting lists can be used in place from the mapped file.
+//
+//   header      "SRCHIDX" and a zero byte, uint32 version, uint32 zero,
+//               uint64 sequence number of the last write-ahead log record
+//               the index includes
+//   stop words  count, then every word as an array of chars
+//   terms       the same, in term id order
+//   documents   count, then arrays of ids, ratings, statuses and lengths as
+//               int32, forward index offsets as uint64, forward index term
+//               ids as int32 and the counts of those words as uint32
+//   postings    count, then per term its id as int64, size as uint64,
+//               maximum term frequency as double and the five arrays of
+//               its sealed PostingList::Image, whose tail arrays are empty
+//   checksum    uint32 CRC-32 of everything before it
+//
+// Counts are uint64, and an array is its item count followed by the items.
+const uint32_t INDEX_FILE_VERSION = 2;
+
+struct IndexFileContents {
+    // Keeps the mapped file alive; everything below points into it.
+    std::shared_ptr<const void> storage;
+    uint64_t log_sequence = 0;
+    std::vector<std::string_view> stop_words;
+    std::vector<std::string_view> terms;
+    std::shared_ptr<const IndexSegment> segment;
+};
+
+// The segment must be sealed, with its terms in increasing id order.
+// The file is written next to the path and renamed over it, so an existing
+// file, including one a server has open, stays intact until the new one is
+// complete. The file and the rename are synced to disk before returning.
+void WriteIndexFile(const std::string& path, uint64_t log_sequence,
+                    const std::vector<std::string_view>& stop_words,
+                    const std::vector<std::string_view>& terms, const IndexSegment& segment);
+
+// Throws std::runtime_error if the file cannot be mapped or is not a valid
+// index file of this version. Nothing read from the file is trusted: the
+// checksum is verified, and every count, offset, term id and ordinal is
+// checked against the file and the sections it refers to before anything is
+// read out of bounds or allocated for it beyond its size. The blocks of a
+// posting list are decoded and compared with its recorded bounds and the
+// forward index only when the list is first read, so opening a file does
+// not decode its postings; see PostingListChecks.
+//
+// The segment reads its postings, document columns and forward index, and
+// the terms their text, in place from the mapping.
+IndexFileContents ReadIndexFile(const std::string& path);
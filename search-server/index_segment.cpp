@@ -0,0 +1,243 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+const DocumentWordFrequencies::Map& DocumentWordFrequencies::Get(
+    const IndexSegment& segment, int ordinal, const TermDictionary& dictionary) const {
+    call_once(built_, [&] {
+        for (size_t i = segment.forward_offsets[ordinal]; i < segment.forward_offsets[ordinal + 1];
+             ++i) {
+            frequencies_.emplace(dictionary.GetTerm(segment.forward_terms[i]),
+                                 segment.GetTermFreq(ordinal, segment.forward_counts[i]));
+        }
+    });
+    return frequencies_;
+}
+
+PostingListChecks::PostingListChecks(size_t list_count)
+    : checks_(make_unique<Check[]>(list_count)) {}
+
+void PostingListChecks::Run(const IndexSegment& segment, size_t index) const {
+    Check& check = checks_[index];
+    // Nothing is thrown out of call_once, which some implementations do
+    // not unwind correctly; the outcome is kept instead.
+    call_once(check.done, [&segment, index, &check] {
+        const PostingList::Image& image = segment.posting_lists[index].GetImage();
+        const int term_id = segment.posting_terms[index];
+        if (!image.tail_ordinals.empty() ||
+            !PostingList::IsValidImage(image, segment.document_lengths)) {
+            return;
+        }
+        for (PostingList::Cursor cursor(image); cursor.Ordinal() != PostingList::Cursor::END;
+             cursor.Next()) {
+            if (!segment.ContainsTerm(cursor.Ordinal(), term_id)) {
+                return;
+            }
+        }
+        check.passed = true;
+    });
+    if (!check.passed) {
+        throw runtime_error("posting list is corrupted");
+    }
+}
+
+vector<TermCount> CountTerms(vector<int> term_ids) {
+    sort(term_ids.begin(), term_ids.end());
+
+    vector<TermCount> terms;
+    for (auto it = term_ids.begin(); it != term_ids.end();) {
+        const auto run_end = upper_bound(it, term_ids.end(), *it);
+        terms.push_back({*it, static_cast<uint32_t>(run_end - it)});
+        it = run_end;
+    }
+    return terms;
+}
+
+PostingList::Image IndexSegment::FindPostings(int term_id) const {
+    if (buffer != nullptr) {
+        return buffer->FindPostings(term_id, GetDocumentCount());
+    }
+    const auto it = lower_bound(posting_terms.begin(), posting_terms.end(), term_id);
+    if (it == posting_terms.end() || *it != term_id) {
+        return {};
+    }
+    return GetPostingList(it - posting_terms.begin()).GetImage();
+}
+
+const PostingList& IndexSegment::GetPostingList(size_t index) const {
+    if (posting_checks != nullptr) {
+        posting_checks->Run(*this, index);
+    }
+    return posting_lists[index];
+}
+
+bool IndexSegment::ContainsTerm(int ordinal, int term_id) const {
+    return binary_search(forward_terms.begin() + forward_offsets[ordinal],
+                         forward_terms.begin() + forward_offsets[ordinal + 1], term_id);
+}
+
+IndexSegment ViewWriteBuffer(shared_ptr<const WriteBuffer> buffer) {
+    IndexSegment segment;
+    segment.forward_offsets = buffer->GetForwardOffsets();
+    segment.forward_terms = buffer->GetForwardTerms();
+    segment.forward_counts = buffer->GetForwardCounts();
+    segment.word_frequencies = buffer->GetWordFrequencies();
+    segment.document_ids = buffer->GetDocumentIds();
+    segment.document_ratings = buffer->GetDocumentRatings();
+    segment.document_status = buffer->GetDocumentStatus();
+    segment.document_lengths = buffer->GetDocumentLengths();
+    segment.buffer = buffer.get();
+    segment.storage = move(buffer);
+    return segment;
+}
+
+struct SegmentBuilder::Arrays {
+    // Moved into posting_terms and posting_lists by Build.
+    map<int, PostingList> term_postings;
+    vector<int> posting_terms;
+    vector<PostingList> posting_lists;
+    vector<size_t> forward_offsets{0};
+    vector<int> forward_terms;
+    vector<uint32_t> forward_counts;
+    vector<shared_ptr<const DocumentWordFrequencies>> word_frequencies;
+    vector<int> document_ids;
+    vector<int> document_ratings;
+    vector<DocumentStatus> document_status;
+    vector<int> document_lengths;
+};
+
+SegmentBuilder::SegmentBuilder() : arrays_(make_shared<Arrays>()) {}
+
+int SegmentBuilder::GetDocumentCount() const {
+    return static_cast<int>(arrays_->document_ids.size());
+}
+
+void SegmentBuilder::AddDocument(int document_id, DocumentStatus status, int rating,
+                                 vector<int> term_ids) {
+    Arrays& arrays = *arrays_;
+    const int ordinal = GetDocumentCount();
+    const auto length = static_cast<int>(term_ids.size());
+
+    for (const TermCount& term : CountTerms(move(term_ids))) {
+        arrays.term_postings[term.term_id].Add(ordinal, term.count,
+                                               term.count / static_cast<double>(length));
+        arrays.forward_terms.push_back(term.term_id);
+        arrays.forward_counts.push_back(term.count);
+    }
+    arrays.forward_offsets.push_back(arrays.forward_terms.size());
+    arrays.word_frequencies.push_back(make_shared<const DocumentWordFrequencies>());
+
+    arrays.document_ids.push_back(document_id);
+    arrays.document_ratings.push_back(rating);
+    arrays.document_status.push_back(status);
+    arrays.document_lengths.push_back(length);
+}
+
+void SegmentBuilder::CopyDocument(const IndexSegment& segment, int ordinal) {
+    Arrays& arrays = *arrays_;
+    arrays.document_ids.push_back(segment.document_ids[ordinal]);
+    arrays.document_ratings.push_back(segment.document_ratings[ordinal]);
+    arrays.document_status.push_back(segment.document_status[ordinal]);
+    arrays.document_lengths.push_back(segment.document_lengths[ordinal]);
+    const size_t begin = segment.forward_offsets[ordinal];
+    const size_t end = segment.forward_offsets[ordinal + 1];
+    arrays.forward_terms.insert(arrays.forward_terms.end(), segment.forward_terms.begin() + begin,
+                                segment.forward_terms.begin() + end);
+    arrays.forward_counts.insert(arrays.forward_counts.end(),
+                                 segment.forward_counts.begin() + begin,
+                                 segment.forward_counts.begin() + end);
+    arrays.forward_offsets.push_back(arrays.forward_terms.size());
+    arrays.word_frequencies.push_back(segment.word_frequencies[ordinal]);
+}
+
+PostingList& SegmentBuilder::GetPostings(int term_id) { return arrays_->term_postings[term_id]; }
+
+IndexSegment SegmentBuilder::Build() {
+    Arrays& arrays = *arrays_;
+    arrays.posting_terms.reserve(arrays.term_postings.size());
+    arrays.posting_lists.reserve(arrays.term_postings.size());
+    for (auto& [term_id, postings] : arrays.term_postings) {
+        postings.Seal();
+        arrays.posting_terms.push_back(term_id);
+        arrays.posting_lists.push_back(move(postings));
+    }
+    arrays.term_postings.clear();
+
+    IndexSegment segment;
+    segment.forward_offsets = arrays.forward_offsets;
+    segment.forward_terms = arrays.forward_terms;
+    segment.forward_counts = arrays.forward_counts;
+    segment.word_frequencies = arrays.word_frequencies;
+    segment.document_ids = arrays.document_ids;
+    segment.document_ratings = arrays.document_ratings;
+    segment.document_status = arrays.document_status;
+    segment.document_lengths = arrays.document_lengths;
+    segment.posting_terms = arrays.posting_terms;
+    segment.posting_lists = arrays.posting_lists;
+    segment.storage = exchange(arrays_, make_shared<Arrays>());
+    return segment;
+}
+
+bool Tombstones::Set(const IndexSegment& segment, int ordinal) {
+    if (!marks_.Set(ordinal)) {
+        return false;
+    }
+    for (size_t i = segment.forward_offsets[ordinal]; i < segment.forward_offsets[ordinal + 1];
+         ++i) {
+        ++posting_counts_[segment.forward_terms[i]];
+    }
+    return true;
+}
+
+size_t SegmentVersion::GetLiveDocumentFreq(int term_id) const {
+    return segment->GetDocumentFreq(term_id) - removed->GetPostingCount(term_id);
+}
+
+IndexSegment MergeSegments(const vector<SegmentVersion>& segments, vector<int>& new_ordinals) {
+    SegmentBuilder merged;
+    new_ordinals.clear();
+
+    for (const auto& version : segments) {
+        // Removals published later are not seen here; the caller carries
+        // them over through new_ordinals.
+        const IndexSegment& segment = *version.segment;
+        const auto segment_ordinals = new_ordinals.size();
+        for (int ordinal = 0; ordinal < segment.GetDocumentCount(); ++ordinal) {
+            if (version.IsRemoved(ordinal)) {
+                new_ordinals.push_back(-1);
+                continue;
+            }
+            new_ordinals.push_back(merged.GetDocumentCount());
+            merged.CopyDocument(segment, ordinal);
+        }
+        const int* ordinal_map = new_ordinals.data() + segment_ordinals;
+
+        segment.ForEachPostings([&](int term_id, const PostingList::Image& postings) {
+            PostingList* merged_postings = nullptr;
+            for (PostingList::Cursor cursor(postings); cursor.Ordinal() != PostingList::Cursor::END;
+                 cursor.Next()) {
+                const int ordinal = cursor.Ordinal();
+                if (ordinal_map[ordinal] < 0) {
+                    continue;
+                }
+                // Terms of purged documents only do not get a posting list.
+                if (merged_postings == nullptr) {
+                    merged_postings = &merged.GetPostings(term_id);
+                }
+                merged_postings->Add(ordinal_map[ordinal], cursor.TermCount(),
+                                     segment.GetTermFreq(ordinal, cursor.TermCount()));
+            }
+        });
+    }
+
+    return merged.Build();
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "array_view.h"
+#include "document.h"
+#include "persistent_bitset.h"
+#include "persistent_map.h"
+#include "posting_list.h"
+#include "term_dictionary.h"
+#include "write_buffer.h"
+
+struct IndexSegment;
+
+// Word frequencies of one document, built on first use from the forward
+// index of a segment holding it, so adding or loading a document does not
+// allocate per word. Every segment holding the document has the same
+// forward index entries for it, so any of them can be passed.
+class DocumentWordFrequencies {
+   public:
+    using Map = std::map<std::string_view, double>;
+
+    const Map& Get(const IndexSegment& segment, int ordinal,
+                   const TermDictionary& dictionary) const;
+
+   private:
+    mutable std::once_flag built_;
+    mutable Map frequencies_;
+};
+
+// One flag per posting list of a segment read from untrusted memory, such as
+// a mapped index file. Every list is checked the first time it is read, so
+// opening the segment does not decode all of its blocks; a list that fails
+// keeps failing whenever it is read.
+class PostingListChecks {
+   public:
+    explicit PostingListChecks(size_t list_count);
+
+    // Throws std::runtime_error unless the list at the index is a valid
+    // image of postings that the forward index of the segment lists.
+    void Run(const IndexSegment& segment, size_t index) const;
+
+   private:
+    struct Check {
+        std::once_flag done;
+        bool passed = false;
+    };
+
+    std::unique_ptr<Check[]> checks_;
+};
+
+// Distinct term of a document and the number of times it occurs.
+struct TermCount {
+    int term_id;
+    uint32_t count;
+};
+
+// Counts the words of a document given by their term ids; the result is
+// sorted by term id.
+std::vector<TermCount> CountTerms(std::vector<int> term_ids);
+
+// A part of the index holding the documents added during some period.
+// Documents are addressed by dense ordinals assigned in insertion order, and
+// per-document attributes are columns indexed by them. Once published a
+// segment is never changed; it is only replaced as a whole by a merge.
+//
+// A segment is a view: its columns and postings point into storage, which
+// it keeps alive. That is memory of its own for a segment made by
+// SegmentBuilder, a mapped index file, or the write buffer, which keeps
+// growing after the view is published without changing what the view reads.
+struct IndexSegment {
+    using WordFrequencies = DocumentWordFrequencies::Map;
+
+    // Forward index: the distinct term ids of the document with ordinal i
+    // are forward_terms[forward_offsets[i], forward_offsets[i + 1]), sorted,
+    // and forward_counts holds how often each occurs there.
+    ArrayView<size_t> forward_offsets;
+    ArrayView<int> forward_terms;
+    ArrayView<uint32_t> forward_counts;
+
+    // Shared with the segments this one is merged into, so a reference to
+    // a map stays valid until the document is purged.
+    ArrayView<std::shared_ptr<const DocumentWordFrequencies>> word_frequencies;
+
+    ArrayView<int> document_ids;
+    ArrayView<int> document_ratings;
+    ArrayView<DocumentStatus> document_status;
+    ArrayView<int> document_lengths;
+
+    // Posting lists of the terms occurring in the segment, by increasing
+    // term id; empty for a view of the write buffer, which looks them up in
+    // buffer instead.
+    ArrayView<int> posting_terms;
+    ArrayView<PostingList> posting_lists;
+    const WriteBuffer* buffer = nullptr;
+
+    // Set if the posting lists come from untrusted memory; a list is then
+    // checked before it is first returned.
+    const PostingListChecks* posting_checks = nullptr;
+
+    std::shared_ptr<const void> storage;
+
+    // Including removed documents.
+    int GetDocumentCount() const { return static_cast<int>(document_ids.size()); }
+
+    // The image is empty if the term does not occur in the segment.
+    PostingList::Image FindPostings(int term_id) const;
+
+    // Calls function(term_id, image) for every term occurring in the
+    // segment: in increasing term id order, except for a view of the write
+    // buffer.
+    template <typename Function>
+    void ForEachPostings(Function function) const {
+        if (buffer != nullptr) {
+            buffer->ForEachPostings(GetDocumentCount(), function);
+            return;
+        }
+        for (size_t i = 0; i < posting_terms.size(); ++i) {
+            function(posting_terms[i], GetPostingList(i).GetImage());
+        }
+    }
+
+    // The posting list at the index in posting_lists, checked first if it
+    // comes from untrusted memory.
+    const PostingList& GetPostingList(size_t index) const;
+
+    // Including removed documents.
+    size_t GetDocumentFreq(int term_id) const { return FindPostings(term_id).size; }
+
+    bool ContainsTerm(int ordinal, int term_id) const;
+
+    double GetTermFreq(int ordinal, uint32_t term_count) const {
+        return term_count / static_cast<double>(document_lengths[ordinal]);
+    }
+};
+
+// A view of the documents added to the write buffer so far. Only the writer
+// of the buffer may make one.
+IndexSegment ViewWriteBuffer(std::shared_ptr<const WriteBuffer> buffer);
+
+// Builds a sealed segment in memory of its own, document by document.
+class SegmentBuilder {
+   public:
+    SegmentBuilder();
+
+    int GetDocumentCount() const;
+
+    // Appends a document given by the term ids of its words.
+    void AddDocument(int document_id, DocumentStatus status, int rating,
+                     std::vector<int> term_ids);
+
+    // Appends a document of another segment without its postings, which
+    // the caller appends to the lists from GetPostings.
+    void CopyDocument(const IndexSegment& segment, int ordinal);
+
+    // The posting list of the term, added empty if there is none yet.
+    PostingList& GetPostings(int term_id);
+
+    // Compresses the tail blocks of the posting lists and hands the arrays
+    // over to the segment; the builder is left empty.
+    IndexSegment Build();
+
+   private:
+    struct Arrays;
+
+    std::shared_ptr<Arrays> arrays_;
+};
+
+// Documents removed from a segment as one generation of the index sees them,
+// and the postings they leave in the lists of their terms until a merge
+// purges them. A published set is never changed: a removal publishes a
+// changed copy next to the same segment, so a query keeps the documents and
+// document frequencies of the generation it started on. The copy shares all
+// but the changed trie nodes with the original.
+class Tombstones {
+   public:
+    bool IsSet(int ordinal) const { return marks_.Test(ordinal); }
+
+    int GetCount() const { return static_cast<int>(marks_.Count()); }
+
+    // Postings of removed documents in the list of the term.
+    size_t GetPostingCount(int term_id) const {
+        const size_t* count = posting_counts_.Find(term_id);
+        return count == nullptr ? 0 : *count;
+    }
+
+    // Ordinal of the live document with the given position among the live
+    // documents of the segment, in O(log segment size).
+    int FindLiveOrdinal(int position) const {
+        return static_cast<int>(marks_.FindClear(position));
+    }
+
+    // Marks a document of the segment and counts its postings, in
+    // O(document length * log(term count)). Returns false if it is already
+    // marked.
+    bool Set(const IndexSegment& segment, int ordinal);
+
+   private:
+    PersistentBitset marks_;
+    PersistentMap<size_t> posting_counts_;
+};
+
+// A segment as one generation of the index sees it. The segment is shared
+// between generations; its tombstones are replaced whenever one of its
+// documents is removed.
+struct SegmentVersion {
+    // Identifies the segment in the document locations of the index. The
+    // write buffer keeps its serial while documents are added to it.
+    uint64_t serial = 0;
+    std::shared_ptr<const IndexSegment> segment = std::make_shared<const IndexSegment>();
+    std::shared_ptr<const Tombstones> removed = std::make_shared<const Tombstones>();
+
+    int GetLiveDocumentCount() const { return segment->GetDocumentCount() - removed->GetCount(); }
+
+    bool IsRemoved(int ordinal) const { return removed->IsSet(ordinal); }
+
+    size_t GetLiveDocumentFreq(int term_id) const;
+};
+
+// Concatenates the segments in the given order into one sealed segment
+// without the removed documents. new_ordinals receives the ordinal in the merged segment
+// of every input document, input by input, or -1 for a purged one.
+IndexSegment MergeSegments(const std::vector<SegmentVersion>& segments,
+                           std::vector<int>& new_ordinals);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "index_segment.h"
+#include "persistent_map.h"
+
+// One immutable generation of the index: the segments visible to queries,
+// oldest first, each with the tombstones of this generation. The last
+// segment is the write buffer; the others are sealed and shared with the
+// generations before and after this one.
+struct IndexSnapshot {
+    // Increases whenever query results may change, that is when documents
+    // are added or removed. Merges keep the results and the IDFs as they
+    // are, so caches of either are keyed by the epoch.
+    uint64_t epoch = 0;
+
+    // Sequence number of the last write-ahead log record applied.
+    uint64_t log_sequence = 0;
+
+    // Size of the term dictionary when the snapshot was published; later
+    // terms do not occur in it.
+    int term_count = 0;
+
+    // Live documents only.
+    int document_count = 0;
+
+    std::vector<SegmentVersion> segments{SegmentVersion{}};
+
+    // Serial for the next segment added; the first write buffer has 0.
+    uint64_t next_segment_serial = 1;
+
+    struct DocumentLocation {
+        uint64_t segment_serial = 0;
+        int ordinal = 0;
+    };
+
+    // Where each live document is. Shared with the generations before and
+    // after this one except for the trie nodes a change copies.
+    PersistentMap<DocumentLocation> documents;
+
+    const IndexSegment& GetBuffer() const { return *segments.back().segment; }
+
+    // Inverse document frequency of the term over the live documents of
+    // this generation. Removed documents are left out at once, so the value
+    // does not depend on when merges purge them. A term of removed documents only does not
+    // score anything and gets 0.
+    double GetIdf(int term_id) const {
+        size_t document_freq = 0;
+        for (const SegmentVersion& segment : segments) {
+            document_freq += segment.GetLiveDocumentFreq(term_id);
+        }
+        if (document_freq == 0) {
+            return 0.0;
+        }
+        return std::log(document_count / static_cast<double>(document_freq));
+    }
+
+    // Position in segments of the live document with the given id and its
+    // ordinal there.
+    std::optional<std::pair<size_t, int>> FindDocument(int document_id) const {
+        const DocumentLocation* location = documents.Find(document_id);
+        if (location == nullptr) {
+            return std::nullopt;
+        }
+        // The segment count is logarithmic in the document count.
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i].serial == location->segment_serial) {
+                return std::pair{i, location->ordinal};
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Records where the live documents of the segment at the given position
+    // are, after it was added or rebuilt.
+    void LocateDocuments(size_t position) {
+        const SegmentVersion& segment = segments[position];
+        for (int ordinal = 0; ordinal < segment.segment->GetDocumentCount(); ++ordinal) {
+            if (!segment.IsRemoved(ordinal)) {
+                documents[segment.segment->document_ids[ordinal]] = {segment.serial, ordinal};
+            }
+        }
+    }
+
+    // Appends an empty write buffer.
+    void AddBuffer() {
+        segments.emplace_back();
+        segments.back().serial = next_segment_serial++;
+    }
+};
@@ -1,10 +1,37 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include "crc32.h"
+#include "paginator.h"
+#include "process_queries.h"
+#include "query_executor.h"
 #include "request_queue.h"
 #include "search_server.h"
+#include "string_processing.h"
 #include "testing_framework.h"
+#include "write_ahead_log.h"
 
 using namespace std;
 
@@ -152,7 +179,7 @@ void TestMatchDocumentReturnActialStatus() {
     server.AddDocument(44, "little cat"s, DocumentStatus::BANNED, {});
     server.AddDocument(45, "giant cat"s, DocumentStatus::REMOVED, {});
 
-    vector<string> words;
+    vector<string_view> words;
     DocumentStatus status;
 
     tie(words, status) = server.MatchDocument("gray", 42);
@@ -189,6 +216,1465 @@ void TestAddWithAverageRating() {
     ASSERT_EQUAL(server.FindTopDocuments("cat")[0].rating, (1 + 2 + 3) / 3);
 }
 
+void TestAddDocumentsInAnyIdOrder() {
+    SearchServer server({});
+    server.AddDocument(44, "gray cat"s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(42, "gray dog"s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(43, "brown cat cat"s, DocumentStatus::ACTUAL, {});
+
+    auto result = server.FindTopDocuments("cat"s);
+
+    ASSERT_EQUAL(result.size(), 2);
+    ASSERT_EQUAL(result[0].id, 43);
+    ASSERT_EQUAL(result[1].id, 44);
+
+    auto [words, _] = server.MatchDocument("gray dog"s, 42);
+
+    ASSERT_EQUAL(words.size(), 2);
+}
+
+void TestMatchDocumentReturnsSortedWords() {
+    SearchServer server("and"s);
+    server.AddDocument(42, "white cat and fancy collar"s, DocumentStatus::ACTUAL, {});
+
+    auto [words, _] = server.MatchDocument("white collar dog cat cat"s, 42);
+
+    ASSERT_EQUAL(words.size(), 3);
+    ASSERT_EQUAL(words[0], "cat"s);
+    ASSERT_EQUAL(words[1], "collar"s);
+    ASSERT_EQUAL(words[2], "white"s);
+}
+
+void TestAddDocumentFromTemporaryBuffer() {
+    SearchServer server(vector<string_view>{"in"sv, "the"sv});
+    {
+        string buffer = "cat in the city"s;
+        server.AddDocument(42, string_view(buffer), DocumentStatus::ACTUAL, {});
+        buffer.assign(buffer.size(), 'x');
+    }
+
+    auto [words, _] = server.MatchDocument("city in cat"sv, 42);
+
+    ASSERT_EQUAL(words.size(), 2);
+    ASSERT_EQUAL(words[0], "cat"s);
+    ASSERT_EQUAL(words[1], "city"s);
+}
+
+void TestFindTopDocumentsWithCustomCount() {
+    SearchServer server({});
+    for (int id = 0; id < 8; ++id) {
+        server.AddDocument(id, "cat dog"s, DocumentStatus::ACTUAL, {id});
+    }
+
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s).size(),
+                 static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    ASSERT(server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 0).empty());
+    // An empty result is returned before any scoring, but the query is
+    // still checked.
+    const auto any_document = [](int document_id, DocumentStatus status, int rating) {
+        return true;
+    };
+    ASSERT(server.FindTopDocuments("cat"s, any_document, 0).empty());
+    ASSERT(server.FindTopDocuments(execution::par, "cat"s, any_document, 0).empty());
+    ASSERT(server.FindTopDocuments(execution::par, "dog"s, DocumentStatus::ACTUAL, 0).empty());
+    auto empty_stepper = server.StartQuery("cat dog"s, DocumentStatus::ACTUAL, 0, 1);
+    ASSERT(empty_stepper.Step());
+    ASSERT(empty_stepper.GetResult().empty());
+    try {
+        server.FindTopDocuments("cat --dog"s, DocumentStatus::ACTUAL, 0);
+        ASSERT_HINT(false, "invalid query must be rejected with top_k 0"s);
+    } catch (const invalid_argument&) {
+    }
+
+    auto result = server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 7);
+
+    ASSERT_EQUAL(result.size(), 7);
+    for (int i = 0; i < 7; ++i) {
+        ASSERT_EQUAL(result[i].id, 7 - i);
+    }
+
+    result = server.FindTopDocuments(
+        "cat"s,
+        [](int document_id, DocumentStatus status, int rating) {
+            return document_id % 2 == 0;
+        },
+        100);
+
+    ASSERT_EQUAL(result.size(), 4);
+    ASSERT_EQUAL(result[0].id, 6);
+    ASSERT_EQUAL(result[3].id, 0);
+
+    // Limits beyond the corpus size do not allocate for them.
+    const size_t unlimited = numeric_limits<size_t>::max();
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, unlimited).size(), 8u);
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, "cat dog"s, DocumentStatus::ACTUAL, unlimited).size(),
+                 8u);
+    auto stepper = server.StartQuery("dog"s, DocumentStatus::ACTUAL, unlimited, 1);
+    while (!stepper.Step()) {
+    }
+    ASSERT_EQUAL(stepper.GetResult().size(), 8u);
+}
+
+void TestNestedQueryInPredicate() {
+    SearchServer server({});
+    server.AddDocument(42, "gray cat"s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(43, "brown cat"s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(44, "gray dog"s, DocumentStatus::ACTUAL, {});
+
+    auto result = server.FindTopDocuments(
+        "cat"s, [&server](int document_id, DocumentStatus status, int rating) {
+            for (const Document& document : server.FindTopDocuments("gray"s)) {
+                if (document.id == document_id) {
+                    return true;
+                }
+            }
+            return false;
+        });
+
+    ASSERT_EQUAL(result.size(), 1);
+    ASSERT_EQUAL(result[0].id, 42);
+}
+
+void TestRelevanceUpdatedAfterAddDocument() {
+    SearchServer server({});
+    server.AddDocument(42, "cat city"s, DocumentStatus::ACTUAL, {});
+    server.AddDocument(43, "dog city"s, DocumentStatus::ACTUAL, {});
+
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s)[0].relevance, 0.5 * log(2.0));
+
+    server.AddDocument(44, "bird city"s, DocumentStatus::ACTUAL, {});
+
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s)[0].relevance, 0.5 * log(3.0));
+}
+
+// Texts of one to max_length words drawn from the dictionary, skewed towards
+// its first words so that posting lengths differ. With word_suffixes set, a
+// number below it is appended to every word, which gives more distinct terms.
+vector<string> MakeRandomTexts(const vector<string>& dictionary, int document_count, int max_length,
+                               int word_suffixes, unsigned seed) {
+    mt19937 generator(seed);
+    vector<string> texts(document_count);
+    for (string& text : texts) {
+        const int length = 1 + generator() % max_length;
+        for (int i = 0; i < length; ++i) {
+            text += dictionary[min(generator() % dictionary.size(), generator() % dictionary.size())];
+            if (word_suffixes > 0) {
+                text += to_string(generator() % word_suffixes);
+            }
+            text += ' ';
+        }
+    }
+    return texts;
+}
+
+// Adds text i as the document with id i, status i % 4 and rating i % 10,
+// except for the ids that is_left_out holds for.
+void AddRandomDocuments(SearchServer& server, const vector<string>& texts,
+                        const function<bool(int)>& is_left_out = [](int) { return false; }) {
+    for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+        if (!is_left_out(id)) {
+            server.AddDocument(id, texts[id], static_cast<DocumentStatus>(id % 4), {id % 10});
+        }
+    }
+}
+
+void AssertSameDocuments(const vector<Document>& result, const vector<Document>& expected,
+                         const string& hint = ""s) {
+    ASSERT_EQUAL_HINT(result.size(), expected.size(), hint);
+    for (size_t i = 0; i < result.size(); ++i) {
+        ASSERT_EQUAL_HINT(result[i].id, expected[i].id, hint);
+        ASSERT_EQUAL_HINT(result[i].relevance, expected[i].relevance, hint);
+        ASSERT_EQUAL_HINT(result[i].rating, expected[i].rating, hint);
+    }
+}
+
+void TestPrunedSearchMatchesExhaustiveSearch() {
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "big"s, "gray"s,
+                                       "tail"s, "collar"s, "fancy"s, "curly"s, "bird"s};
+    SearchServer server({});
+    const int document_count = 1000;
+    AddRandomDocuments(server, MakeRandomTexts(dictionary, document_count, 12, 0, 42));
+
+    const vector<string> queries = {"cat"s, "cat dog"s, "bird curly fancy"s, "cat dog city big gray"s,
+                                    "cat dog -bird"s, "tail collar -cat -dog"s, "fancy curly -fancy"s};
+    for (const string& query : queries) {
+        const auto all = server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count);
+        for (size_t top_k : {1, 5, 50}) {
+            const vector<Document> expected(all.begin(), all.begin() + min(top_k, all.size()));
+            AssertSameDocuments(server.FindTopDocuments(query, DocumentStatus::ACTUAL, top_k), expected,
+                                query);
+        }
+    }
+}
+
+void TestSearchOverManyPostingBlocks() {
+    SearchServer server({});
+    const int document_count = 1000;
+    for (int id = 0; id < document_count; ++id) {
+        string text = "dog"s;
+        // Every third document has the word, so ordinal deltas vary
+        for (int i = 0; id % 3 == 0 && i < id % 5 + 1; ++i) {
+            text += " cat"s;
+        }
+        server.AddDocument(id * 1000, text, DocumentStatus::ACTUAL, {});
+    }
+
+    const int cat_documents = (document_count + 2) / 3;
+    const double idf = log(document_count / static_cast<double>(cat_documents));
+
+    auto result = server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, document_count);
+
+    ASSERT_EQUAL(result.size(), static_cast<size_t>(cat_documents));
+    for (const Document& document : result) {
+        const int id = document.id / 1000;
+        ASSERT_EQUAL(id % 3, 0);
+        const int cat_count = id % 5 + 1;
+        ASSERT_EQUAL(document.relevance, cat_count / static_cast<double>(cat_count + 1) * idf);
+    }
+
+    ASSERT_EQUAL(get<0>(server.MatchDocument("cat"s, 999000)).size(), 1);
+    ASSERT(get<0>(server.MatchDocument("cat"s, 998000)).empty());
+}
+
+void TestSealedSegmentCompressesTails() {
+    // Most terms have fewer postings than a block, as in real text.
+    SegmentBuilder builder;
+    map<int, vector<pair<int, uint32_t>>> expected;
+    for (int id = 0; id < 3000; ++id) {
+        vector<int> terms;
+        for (int i = 0; i < 5; ++i) {
+            const int term_id = (id * 7 + i * 61) % 300;
+            terms.push_back(term_id);
+            expected[term_id].emplace_back(id, 1);
+        }
+        builder.AddDocument(id, DocumentStatus::ACTUAL, 0, move(terms));
+    }
+    const IndexSegment segment = builder.Build();
+
+    size_t posting_count = 0;
+    size_t encoded_size = 0;
+    segment.ForEachPostings([&](int term_id, const PostingList::Image& postings) {
+        ASSERT(postings.tail_ordinals.empty());
+        posting_count += postings.size;
+        encoded_size += postings.data.size();
+
+        vector<pair<int, uint32_t>> decoded;
+        for (PostingList::Cursor cursor(postings); cursor.Ordinal() != PostingList::Cursor::END;
+             cursor.Next()) {
+            decoded.emplace_back(cursor.Ordinal(), cursor.TermCount());
+        }
+        ASSERT(decoded == expected[term_id]);
+    });
+    ASSERT_EQUAL(posting_count, 5u * 3000);
+    // An uncompressed tail takes 8 bytes per posting.
+    ASSERT_HINT(encoded_size < 3 * posting_count, to_string(encoded_size));
+
+    PostingList postings;
+    postings.Add(0, 1, 1.0);
+    postings.Seal();
+    try {
+        postings.Add(5000, 1, 1.0);
+        ASSERT_HINT(false, "sealed posting list must be read-only"s);
+    } catch (const logic_error&) {
+    }
+}
+
+void TestParallelSearchMatchesSequentialSearch() {
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "big"s, "gray"s,
+                                       "tail"s, "collar"s, "fancy"s, "curly"s, "bird"s};
+    SearchServer server({});
+    AddRandomDocuments(server, MakeRandomTexts(dictionary, 5000, 8, 0, 7));
+
+    const auto even_ids = [](int document_id, DocumentStatus status, int rating) {
+        return document_id % 2 == 0;
+    };
+
+    for (const string& query : {"cat"s, "curly bird"s, "cat dog city -bird"s, "tail -tail"s}) {
+        for (size_t top_k : {1, 5, 100}) {
+            const auto sequential = server.FindTopDocuments(execution::seq, query,
+                                                            DocumentStatus::IRRELEVANT, top_k);
+            const auto parallel = server.FindTopDocuments(execution::par, query,
+                                                          DocumentStatus::IRRELEVANT, top_k);
+            AssertSameDocuments(parallel, sequential, query);
+
+            AssertSameDocuments(server.FindTopDocuments(execution::par, query, even_ids, top_k),
+                                server.FindTopDocuments(query, even_ids, top_k), query);
+        }
+    }
+
+    ASSERT_EQUAL(server.FindTopDocuments(execution::par, "cat"s).size(),
+                 server.FindTopDocuments("cat"s).size());
+}
+
+void TestProcessQueries() {
+    SearchServer server("and with"s);
+    int id = 0;
+    for (const string& text : {"funny pet and nasty rat"s, "funny pet with curly hair"s,
+                               "funny pet and not very nasty rat"s, "pet with rat and rat and rat"s,
+                               "nasty rat with curly hair"s}) {
+        server.AddDocument(++id, text, DocumentStatus::ACTUAL, {1, 2});
+    }
+
+    const vector<string> queries = {"nasty rat -not"s, "not very funny nasty pet"s, "curly hair"s,
+                                    "unknown"s};
+
+    const auto results = ProcessQueries(server, queries);
+    ASSERT_EQUAL(results.size(), queries.size());
+
+    vector<Document> expected_joined;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto expected = server.FindTopDocuments(queries[i]);
+        ASSERT_EQUAL(results[i].size(), expected.size());
+        for (size_t j = 0; j < expected.size(); ++j) {
+            ASSERT_EQUAL(results[i][j].id, expected[j].id);
+        }
+        expected_joined.insert(expected_joined.end(), expected.begin(), expected.end());
+    }
+
+    const auto joined = ProcessQueriesJoined(server, queries);
+    ASSERT_EQUAL(joined.size(), expected_joined.size());
+    for (size_t i = 0; i < joined.size(); ++i) {
+        ASSERT_EQUAL(joined[i].id, expected_joined[i].id);
+    }
+
+    // An invalid query throws to the caller as it does from FindTopDocuments.
+    try {
+        ProcessQueries(server, {"nasty rat"s, "--rat"s, "curly hair"s});
+        ASSERT_HINT(false, "invalid query must be rejected"s);
+    } catch (const invalid_argument&) {
+    }
+    try {
+        ProcessQueriesJoined(server, {"--rat"s});
+        ASSERT_HINT(false, "invalid query must be rejected"s);
+    } catch (const invalid_argument&) {
+    }
+
+    // So does a throwing predicate of a parallel query.
+    try {
+        server.FindTopDocuments(execution::par, "nasty rat"s, [](int document_id, DocumentStatus, int) {
+            if (document_id == 3) {
+                throw out_of_range("predicate failed");
+            }
+            return true;
+        });
+        ASSERT_HINT(false, "predicate exception must reach the caller"s);
+    } catch (const out_of_range&) {
+    }
+}
+
+void TestSearchWhileAddingDocuments() {
+    const int document_count = 300;
+    SearchServer server(""s);
+    server.AddDocument(0, "cat"s, DocumentStatus::ACTUAL, {1});
+
+    // Every document brings a new word as well, so the write buffer grows
+    // its term table while queries read it.
+    thread writer([&server] {
+        for (int id = 1; id < document_count; ++id) {
+            server.AddDocument(id, (id % 2 == 0 ? "cat word"s : "cat dog word"s) + to_string(id),
+                               DocumentStatus::ACTUAL, {id});
+        }
+    });
+
+    // Every query sees some complete generation, so the number of matches
+    // never decreases and every found document can be matched.
+    size_t previous_size = 0;
+    while (previous_size < static_cast<size_t>(document_count)) {
+        const auto documents =
+            server.FindTopDocuments("cat"s, [](int, DocumentStatus, int) { return true; },
+                                    document_count);
+        ASSERT(documents.size() >= previous_size);
+        for (const Document& document : documents) {
+            const auto [words, status] = server.MatchDocument("cat dog"s, document.id);
+            ASSERT(!words.empty());
+        }
+        previous_size = documents.size();
+    }
+
+    writer.join();
+    ASSERT_EQUAL(server.GetDocumentCount(), document_count);
+}
+
+void TestSearchAcrossMergedSegments() {
+    // Every third document has "dog" and the others "city" once or twice,
+    // so "dog" has IDF log(3) and "city" log(1.5) in any segment layout.
+    SearchServer server({});
+    const int document_count = 3000;
+    const vector<string> texts = {"cat dog"s, "cat city city"s, "cat city tail"s};
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, texts[id % 3], DocumentStatus::ACTUAL, {id % 10});
+    }
+
+    // Equal relevance is ranked by rating, then by id.
+    vector<Document> expected;
+    const vector<pair<int, double>> groups = {{0, 0.5 * log(3.0)}, {1, 2.0 / 3 * log(1.5)}};
+    for (const auto& [remainder, relevance] : groups) {
+        for (int rating = 9; rating >= 0; --rating) {
+            for (int id = 0; id < document_count; ++id) {
+                if (id % 3 == remainder && id % 10 == rating) {
+                    expected.push_back({id, relevance, rating});
+                }
+            }
+        }
+    }
+    const string query = "dog city -tail"s;
+    AssertSameDocuments(server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count),
+                        expected);
+
+    server.WaitForMerges();
+
+    ASSERT_EQUAL(server.GetDocumentCount(), document_count);
+    for (int index = 0; index < document_count; index += 97) {
+        ASSERT_EQUAL(server.GetDocumentId(index), index);
+    }
+    AssertSameDocuments(server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count),
+                        expected);
+}
+
+void TestRemoveDocument() {
+    SearchServer server({});
+    server.AddDocument(1, "cat city"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "cat dog"s, DocumentStatus::ACTUAL, {2});
+    server.AddDocument(3, "dog city"s, DocumentStatus::ACTUAL, {3});
+
+    server.RemoveDocument(2);
+    server.RemoveDocument(100);
+
+    ASSERT_EQUAL(server.GetDocumentCount(), 2);
+    ASSERT_EQUAL(server.GetDocumentId(0), 1);
+    ASSERT_EQUAL(server.GetDocumentId(1), 3);
+    try {
+        server.GetDocumentId(2);
+        ASSERT_HINT(false, "index past the live documents must be rejected"s);
+    } catch (const out_of_range&) {
+    }
+
+    const auto found = server.FindTopDocuments("cat dog"s);
+    ASSERT_EQUAL(found.size(), 2u);
+    for (const Document& document : found) {
+        ASSERT(document.id != 2);
+    }
+
+    try {
+        server.MatchDocument("cat"s, 2);
+        ASSERT_HINT(false, "removed document must not be matched"s);
+    } catch (const out_of_range&) {
+    }
+
+    server.AddDocument(2, "bird"s, DocumentStatus::ACTUAL, {});
+    ASSERT_EQUAL(server.FindTopDocuments("bird"s).size(), 1u);
+
+    server.RemoveDocument(execution::par, 2);
+    ASSERT(server.FindTopDocuments("bird"s).empty());
+    ASSERT_EQUAL(server.GetDocumentCount(), 2);
+}
+
+void TestRemovalKeepsDocumentIdsInOrder() {
+    // One segment larger than a leaf of the tombstone trie, with sparse ids.
+    const int document_count = 5000;
+    vector<DocumentInput> documents;
+    vector<int> live_ids;
+    for (int i = 0; i < document_count; ++i) {
+        documents.push_back({i * 1000 + 7, "cat"sv, DocumentStatus::ACTUAL, {}});
+        live_ids.push_back(i * 1000 + 7);
+    }
+    SearchServer server({});
+    server.AddDocuments(documents);
+
+    mt19937 generator(23);
+    for (int step = 0; step < 600; ++step) {
+        const auto position = uniform_int_distribution<size_t>(0, live_ids.size() - 1)(generator);
+        const int id = live_ids[position];
+        server.RemoveDocument(id);
+        live_ids.erase(live_ids.begin() + position);
+        if (step % 3 == 0) {
+            server.AddDocument(id, "dog"s, DocumentStatus::ACTUAL, {});
+            live_ids.push_back(id);
+        }
+
+        ASSERT_EQUAL(server.GetDocumentCount(), static_cast<int>(live_ids.size()));
+        for (size_t index = step % 7; index < live_ids.size(); index += 331) {
+            ASSERT_EQUAL(server.GetDocumentId(static_cast<int>(index)), live_ids[index]);
+        }
+        ASSERT_EQUAL(server.GetDocumentId(static_cast<int>(live_ids.size()) - 1), live_ids.back());
+        const int live_id = live_ids[position % live_ids.size()];
+        ASSERT_EQUAL(get<0>(server.MatchDocument("cat dog"s, live_id)).size(), 1u);
+    }
+}
+
+void TestCompactionPurgesRemovedDocuments() {
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "big"s, "gray"s, "tail"s};
+    const int document_count = 2048;
+    const auto texts = MakeRandomTexts(dictionary, document_count, 6, 0, 11);
+
+    SearchServer server({});
+    AddRandomDocuments(server, texts);
+
+    // Removed documents leave the IDFs at once, so results match a server
+    // that never had them whether or not a merge has purged them.
+    const auto assert_same_as_fresh = [&](const auto& is_removed) {
+        SearchServer expected_server({});
+        AddRandomDocuments(expected_server, texts, is_removed);
+        ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+        for (const string& query : {"cat"s, "dog city -tail"s, "big gray"s}) {
+            AssertSameDocuments(
+                server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count),
+                expected_server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count), query);
+        }
+    };
+
+    // Too few removals for compaction: the postings stay.
+    const auto is_scattered = [](int id) { return id % 10 == 0; };
+    for (int id = 0; id < document_count; id += 10) {
+        server.RemoveDocument(id);
+    }
+    assert_same_as_fresh(is_scattered);
+    server.WaitForMerges();
+    assert_same_as_fresh(is_scattered);
+
+    // The oldest segments are emptied completely, so compaction drops every
+    // removed posting.
+    const int removed_count = document_count / 2;
+    for (int id = 0; id < removed_count; ++id) {
+        server.RemoveDocument(id);
+    }
+    const auto is_removed = [&](int id) { return id < removed_count || is_scattered(id); };
+    assert_same_as_fresh(is_removed);
+    server.WaitForMerges();
+    assert_same_as_fresh(is_removed);
+    ASSERT_EQUAL(server.GetDocumentId(10), removed_count + 11);
+}
+
+void TestRemovalKeepsRunningQuerySnapshot() {
+    // Even documents are "cat dog", so both words have IDF log(2).
+    const int document_count = 1024;
+    SearchServer server({});
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, id % 2 == 0 ? "cat dog"s : "city"s, DocumentStatus::ACTUAL,
+                           {id % 10});
+    }
+    server.WaitForMerges();
+
+    // Equal relevance is ranked by rating, then by id.
+    const double relevance = 0.5 * log(2.0) + 0.5 * log(2.0);
+    vector<Document> expected;
+    for (int rating = 9; rating >= 0; --rating) {
+        for (int id = 0; id < document_count; id += 2) {
+            if (id % 10 == rating) {
+                expected.push_back({id, relevance, rating});
+            }
+        }
+    }
+
+    // Removing every match between the steps of a running query changes
+    // neither its documents nor their IDFs.
+    const string query = "cat dog"s;
+    auto stepper = server.StartQuery(query, DocumentStatus::ACTUAL, document_count, 50);
+    ASSERT(!stepper.Step());
+    for (int id = 0; id < document_count; id += 2) {
+        server.RemoveDocument(id);
+    }
+    int step_count = 1;
+    while (!stepper.Step()) {
+        ++step_count;
+    }
+    ASSERT(step_count > 2);
+    AssertSameDocuments(stepper.GetResult(), expected);
+
+    ASSERT(server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count).empty());
+    ASSERT_EQUAL(server.GetDocumentCount(), document_count / 2);
+}
+
+void TestGetWordFrequencies() {
+    SearchServer server("in"s);
+    server.AddDocument(1, "cat in the city cat"s, DocumentStatus::ACTUAL, {});
+
+    const auto& frequencies = server.GetWordFrequencies(1);
+    ASSERT_EQUAL(frequencies.size(), 3u);
+    ASSERT_EQUAL(frequencies.at("cat"sv), 0.5);
+    ASSERT_EQUAL(frequencies.at("city"sv), 0.25);
+
+    ASSERT(server.GetWordFrequencies(2).empty());
+
+    // Sealing and merging the segment does not move the map.
+    for (int id = 2; id < 1100; ++id) {
+        server.AddDocument(id, "dog"s, DocumentStatus::ACTUAL, {});
+    }
+    server.WaitForMerges();
+    ASSERT(&server.GetWordFrequencies(1) == &frequencies);
+}
+
+void TestParallelMatchDocument() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, {1});
+    server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::BANNED, {2});
+
+    string long_query;
+    for (int i = 0; i < 1000; ++i) {
+        long_query += "word"s + to_string(i) + ' ';
+    }
+    long_query += "rat funny curly"s;
+
+    for (int id : {1, 2}) {
+        const auto [words, status] = server.MatchDocument(execution::par, long_query, id);
+        const auto [expected_words, expected_status] = server.MatchDocument(long_query, id);
+        ASSERT(words == expected_words);
+        ASSERT_EQUAL(status, expected_status);
+    }
+
+    const auto [words, status] = server.MatchDocument(execution::par, long_query + " -nasty"s, 1);
+    ASSERT(words.empty());
+    ASSERT_EQUAL(status, DocumentStatus::ACTUAL);
+
+    const auto [seq_words, seq_status] = server.MatchDocument(execution::seq, "curly -rat"s, 2);
+    ASSERT_EQUAL(seq_words.size(), 1u);
+    ASSERT_EQUAL(seq_words[0], "curly"sv);
+    ASSERT_EQUAL(seq_status, DocumentStatus::BANNED);
+
+    try {
+        server.MatchDocument(execution::par, "rat"s, 3);
+        ASSERT_HINT(false, "unknown document must not be matched"s);
+    } catch (const out_of_range&) {
+    }
+}
+
+void TestAddDocumentsMatchesAddDocument() {
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "big"s, "gray"s, "tail"s, "and"s};
+    const int document_count = 3000;
+    const auto texts = MakeRandomTexts(dictionary, document_count, 8, 50, 5);
+
+    SearchServer server("and0"s);
+    SearchServer expected_server("and0"s);
+    server.AddDocument(2 * document_count, "cat0 dog1"s, DocumentStatus::ACTUAL, {});
+    expected_server.AddDocument(2 * document_count, "cat0 dog1"s, DocumentStatus::ACTUAL, {});
+
+    vector<DocumentInput> batch;
+    for (int id = 0; id < document_count; ++id) {
+        const DocumentStatus status = id % 10 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        batch.push_back({id, texts[id], status, {id % 5, id % 3}});
+        expected_server.AddDocument(id, texts[id], status, {id % 5, id % 3});
+    }
+    server.AddDocuments(batch);
+
+    ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+    ASSERT_EQUAL(server.GetDocumentId(1), 0);
+    ASSERT(server.GetWordFrequencies(7) == expected_server.GetWordFrequencies(7));
+
+    for (const string& query : {"cat1 dog2"s, "city3 big4 -gray5"s, "tail6 tail7 cat0"s}) {
+        AssertSameDocuments(
+            server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count),
+            expected_server.FindTopDocuments(query, DocumentStatus::ACTUAL, document_count), query);
+    }
+}
+
+void TestAddDocumentsIsAllOrNothing() {
+    SearchServer server({});
+    server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {});
+
+    const vector<vector<DocumentInput>> invalid_batches = {
+        {{2, "dog"sv, DocumentStatus::ACTUAL, {}}, {1, "bird"sv, DocumentStatus::ACTUAL, {}}},
+        {{2, "dog"sv, DocumentStatus::ACTUAL, {}}, {2, "bird"sv, DocumentStatus::ACTUAL, {}}},
+        {{2, "dog"sv, DocumentStatus::ACTUAL, {}}, {-3, "bird"sv, DocumentStatus::ACTUAL, {}}},
+        {{2, "dog"sv, DocumentStatus::ACTUAL, {}}, {3, "bi\x12rd"sv, DocumentStatus::ACTUAL, {}}},
+    };
+    for (const auto& batch : invalid_batches) {
+        try {
+            server.AddDocuments(batch);
+            ASSERT_HINT(false, "invalid batch must be rejected"s);
+        } catch (const invalid_argument&) {
+        }
+        ASSERT_EQUAL(server.GetDocumentCount(), 1);
+    }
+    ASSERT(server.FindTopDocuments("dog"s).empty());
+}
+
+void TestSegmentCountStaysLogarithmic() {
+    const auto add_batch = [](SearchServer& server, int& next_id, int size) {
+        vector<DocumentInput> batch;
+        for (int i = 0; i < size; ++i) {
+            batch.push_back({next_id++, "cat dog"sv, DocumentStatus::ACTUAL, {}});
+        }
+        server.AddDocuments(batch);
+    };
+
+    // A single document before every batch used to be sealed as a segment
+    // of its own, and interleaved tiers were never merged.
+    SearchServer server({});
+    int next_id = 0;
+    for (int round = 0; round < 40; ++round) {
+        server.AddDocument(next_id++, "bird"s, DocumentStatus::ACTUAL, {});
+        add_batch(server, next_id, 1100);
+    }
+    server.WaitForMerges();
+    ASSERT_HINT(server.GetSegmentCount() <= 8, to_string(server.GetSegmentCount()));
+
+    SearchServer interleaved({});
+    next_id = 0;
+    for (int round = 0; round < 40; ++round) {
+        add_batch(interleaved, next_id, 300);
+        add_batch(interleaved, next_id, 1100);
+    }
+    interleaved.WaitForMerges();
+    // A few segments per tier instead of one per batch.
+    ASSERT_HINT(interleaved.GetSegmentCount() <= 16, to_string(interleaved.GetSegmentCount()));
+    ASSERT_EQUAL(interleaved.GetDocumentCount(), next_id);
+    ASSERT_EQUAL(interleaved.GetDocumentId(300), 300);
+}
+
+void TestAddDocumentCostDoesNotGrowWithBuffer() {
+    // Adding a document used to copy the whole write buffer, so its cost grew
+    // with the documents already buffered. It is compared with building a
+    // segment of the same documents, whose cost per document is constant.
+    vector<string> words;
+    for (int i = 0; i < 5000; ++i) {
+        words.push_back("word"s + to_string(i));
+    }
+    const int document_count = 2048;
+    const int document_length = 40;
+    vector<string> texts;
+    vector<vector<int>> terms;
+    for (int id = 0; id < document_count; ++id) {
+        string& text = texts.emplace_back();
+        auto& document_terms = terms.emplace_back();
+        for (int i = 0; i < document_length; ++i) {
+            const int term_id = (id * 131 + i * 97) % static_cast<int>(words.size());
+            text += words[term_id] + " "s;
+            document_terms.push_back(term_id);
+        }
+    }
+
+    using Clock = chrono::steady_clock;
+    const auto build_start = Clock::now();
+    SegmentBuilder builder;
+    for (int id = 0; id < document_count; ++id) {
+        builder.AddDocument(id, DocumentStatus::ACTUAL, 0, terms[id]);
+    }
+    const IndexSegment segment = builder.Build();
+    const auto build_time = Clock::now() - build_start;
+
+    SearchServer server({});
+    const auto add_start = Clock::now();
+    for (int id = 0; id < document_count; ++id) {
+        server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, {});
+    }
+    const auto add_time = Clock::now() - add_start;
+
+    ASSERT_EQUAL(segment.GetDocumentCount(), document_count);
+    ASSERT_EQUAL(server.GetDocumentCount(), document_count);
+    // Tokenizing, interning, publishing and sealing add a small factor;
+    // copying the buffer added two orders of magnitude.
+    ASSERT_HINT(add_time < 25 * build_time,
+                to_string(chrono::duration_cast<chrono::microseconds>(add_time).count()) +
+                    " us to add, "s +
+                    to_string(chrono::duration_cast<chrono::microseconds>(build_time).count()) +
+                    " us to build"s);
+}
+
+// Directory under the system temporary directory, removed together with its
+// files when the object is destroyed.
+class TemporaryDirectory {
+   public:
+    TemporaryDirectory() {
+        string pattern = (filesystem::temp_directory_path() / "search_server_test.XXXXXX").string();
+        if (mkdtemp(pattern.data()) == nullptr) {
+            throw runtime_error("cannot create a temporary directory"s);
+        }
+        path_ = pattern;
+    }
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    ~TemporaryDirectory() {
+        error_code error;
+        filesystem::remove_all(path_, error);
+    }
+
+    string GetPath(const string& name) const { return (path_ / name).string(); }
+
+   private:
+    filesystem::path path_;
+};
+
+void TestSaveAndOpenIndex() {
+    const TemporaryDirectory directory;
+
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "big"s, "gray"s, "tail"s, "in"s};
+    SearchServer server("in"s);
+    const int document_count = 1500;
+    AddRandomDocuments(server, MakeRandomTexts(dictionary, document_count, 8, 30, 3));
+
+    const string path = directory.GetPath("index"s);
+    server.SaveIndex(path);
+    {
+        const SearchServer opened = SearchServer::OpenIndex(path);
+        ASSERT_EQUAL(opened.GetDocumentCount(), document_count);
+        ASSERT(opened.GetWordFrequencies(5) == server.GetWordFrequencies(5));
+        ASSERT(&opened.GetWordFrequencies(5) == &opened.GetWordFrequencies(5));
+
+        for (const string& query : {"cat1 dog2 in"s, "city3 big4 -gray5"s, "tail6 cat0 -cat1"s}) {
+            AssertSameDocuments(opened.FindTopDocuments(query, DocumentStatus::ACTUAL, 100),
+                                server.FindTopDocuments(query, DocumentStatus::ACTUAL, 100), query);
+            for (int id : {0, 7, 1499}) {
+                ASSERT(opened.MatchDocument(query, id) == server.MatchDocument(query, id));
+            }
+        }
+    }
+
+    server.RemoveDocument(0);
+    server.SaveIndex(path);
+    {
+        SearchServer opened = SearchServer::OpenIndex(path);
+        ASSERT_EQUAL(opened.GetDocumentCount(), document_count - 1);
+        ASSERT(opened.GetWordFrequencies(0).empty());
+
+        // New documents are merged with the mapped segment as usual.
+        for (int id = document_count; id < document_count * 2; ++id) {
+            opened.AddDocument(id, "cat1 bird"s, DocumentStatus::ACTUAL, {});
+        }
+        opened.RemoveDocument(1);
+        opened.WaitForMerges();
+        ASSERT_EQUAL(opened.GetDocumentCount(), document_count * 2 - 2);
+        ASSERT_EQUAL(opened.FindTopDocuments("bird"s, DocumentStatus::ACTUAL, document_count * 2).size(),
+                     static_cast<size_t>(document_count));
+
+        // Saving over the mapped file keeps the open server reading the old one.
+        const auto find_actual = [&opened] {
+            return opened.FindTopDocuments(
+                "cat1 dog2"s,
+                [](int document_id, DocumentStatus status, int rating) {
+                    return status == DocumentStatus::ACTUAL;
+                },
+                100);
+        };
+        const auto before = find_actual();
+        ASSERT(!before.empty());
+        opened.SaveIndex(path);
+        AssertSameDocuments(find_actual(), before);
+        ASSERT_EQUAL(SearchServer::OpenIndex(path).GetDocumentCount(), document_count * 2 - 2);
+    }
+
+    {
+        ofstream output(path, ios::binary | ios::trunc);
+        output << "not an index"s;
+    }
+    try {
+        SearchServer::OpenIndex(path);
+        ASSERT_HINT(false, "invalid index file must be rejected"s);
+    } catch (const runtime_error&) {
+    }
+}
+
+void TestCrc32() {
+    // The check value of CRC-32 (IEEE 802.3).
+    ASSERT_EQUAL(ComputeCrc32("123456789"s), 0xCBF43926u);
+    ASSERT_EQUAL(ComputeCrc32(""s), 0u);
+
+    string data;
+    for (int i = 0; i < 100; ++i) {
+        data += static_cast<char>(i * 37);
+    }
+    uint32_t crc = 0;
+    for (size_t offset = 0; offset < data.size(); offset += 3) {
+        crc = ComputeCrc32(string_view(data).substr(offset, 3), crc);
+    }
+    ASSERT_EQUAL(crc, ComputeCrc32(data));
+}
+
+void TestOpenCorruptedIndex() {
+    const TemporaryDirectory directory;
+    const string path = directory.GetPath("index"s);
+
+    SearchServer server("in"s);
+    const int document_count = 40;
+    AddRandomDocuments(server, MakeRandomTexts({"cat"s, "dog"s, "city"s}, document_count, 6, 3, 5));
+    server.SaveIndex(path);
+    string contents;
+    {
+        ifstream input(path, ios::binary);
+        contents.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    }
+
+    // Returns false if the file is rejected; an accepted file must be safe
+    // to search, match and change.
+    const auto open_and_use = [&path, document_count](const string& file) {
+        {
+            ofstream output(path, ios::binary | ios::trunc);
+            output << file;
+        }
+        try {
+            SearchServer opened = SearchServer::OpenIndex(path);
+            opened.FindTopDocuments("cat0 dog1 -city2"s, DocumentStatus::ACTUAL, 10);
+            for (int id = 0; id < document_count; ++id) {
+                try {
+                    opened.MatchDocument("cat0 dog1 city2"s, id);
+                    opened.RemoveDocument(id);
+                } catch (const out_of_range&) {
+                }
+            }
+            return true;
+        } catch (const runtime_error&) {
+            return false;
+        }
+    };
+    ASSERT(open_and_use(contents));
+
+    for (size_t size = 0; size < contents.size(); size += 4) {
+        ASSERT_HINT(!open_and_use(contents.substr(0, size)), "truncated to "s + to_string(size));
+    }
+
+    // The checksum catches any corrupted byte.
+    for (size_t offset = 0; offset < contents.size(); ++offset) {
+        string corrupted = contents;
+        corrupted[offset] ^= 0x10;
+        ASSERT_HINT(!open_and_use(corrupted), "corrupted at "s + to_string(offset));
+    }
+
+    // With the checksum fixed up, the structure checks must reject every
+    // value that would make a reader go out of bounds or allocate too much.
+    const size_t checksum_offset = contents.size() - 8;
+    for (size_t offset = 0; offset < checksum_offset; offset += 4) {
+        for (const uint32_t value : {0xFFFFFFFFu, 0x7FFFFFFFu, 0x10000u, 0x40u, 1u, 0u}) {
+            string corrupted = contents;
+            memcpy(corrupted.data() + offset, &value, sizeof(value));
+            const uint32_t crc = ComputeCrc32(string_view(corrupted).substr(0, checksum_offset));
+            memcpy(corrupted.data() + checksum_offset, &crc, sizeof(crc));
+            open_and_use(corrupted);
+        }
+    }
+}
+
+void TestValidImageChecksBlockBounds() {
+    SegmentBuilder builder;
+    for (int id = 0; id < 300; ++id) {
+        vector<int> terms = {0};
+        for (int i = 0; i < id % 5; ++i) {
+            terms.push_back(1 + i % 2);
+        }
+        builder.AddDocument(id, DocumentStatus::ACTUAL, 0, move(terms));
+    }
+    const IndexSegment segment = builder.Build();
+
+    // A block bound below the postings would make pruning skip documents
+    // it should score, and one above them only comes from a corrupted file.
+    const PostingList::Image image = segment.FindPostings(0);
+    ASSERT(image.blocks.size() > 2);
+    ASSERT(PostingList::IsValidImage(image, segment.document_lengths));
+    for (size_t block = 0; block < image.blocks.size(); ++block) {
+        for (const double factor : {0.5, 2.0}) {
+            vector<PostingList::BlockBound> blocks(image.blocks.begin(), image.blocks.end());
+            blocks[block].max_term_freq *= factor;
+            PostingList::Image corrupted = image;
+            corrupted.blocks = blocks;
+            ASSERT(!PostingList::IsValidImage(corrupted, segment.document_lengths));
+        }
+    }
+    PostingList::Image corrupted = image;
+    corrupted.max_term_freq /= 2;
+    ASSERT(!PostingList::IsValidImage(corrupted, segment.document_lengths));
+}
+
+void TestPostingListsAreCheckedOnFirstRead() {
+    SegmentBuilder builder;
+    builder.AddDocument(0, DocumentStatus::ACTUAL, 0, {0, 1});
+    builder.AddDocument(1, DocumentStatus::ACTUAL, 0, {0, 0, 2});
+    const IndexSegment built = builder.Build();
+    ASSERT(vector<int>(built.posting_terms.begin(), built.posting_terms.end()) ==
+           (vector<int>{0, 1, 2}));
+
+    // The list of term 1 claims document 1, whose forward index lacks it.
+    vector<PostingList> lists(built.posting_lists.begin(), built.posting_lists.end());
+    lists[1] = PostingList();
+    lists[1].Add(1, 1, 1 / 3.0);
+    lists[1].Seal();
+    const PostingListChecks checks(lists.size());
+    IndexSegment segment = built;
+    segment.posting_lists = lists;
+    segment.posting_checks = &checks;
+
+    ASSERT_EQUAL(segment.FindPostings(0).size, 2u);
+    ASSERT_EQUAL(segment.FindPostings(2).size, 1u);
+    // A list that fails its check keeps failing.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        try {
+            segment.FindPostings(1);
+            ASSERT_HINT(false, "corrupted posting list must be rejected"s);
+        } catch (const runtime_error&) {
+        }
+    }
+    try {
+        segment.ForEachPostings([](int, const PostingList::Image&) {});
+        ASSERT_HINT(false, "corrupted posting list must be rejected"s);
+    } catch (const runtime_error&) {
+    }
+}
+
+void TestWriteAheadLogReplay() {
+    const TemporaryDirectory directory;
+    const string index_path = directory.GetPath("index"s);
+    const string log_path = directory.GetPath("log"s);
+
+    const auto assert_same_results = [](const SearchServer& replayed, const SearchServer& expected) {
+        ASSERT_EQUAL(replayed.GetDocumentCount(), expected.GetDocumentCount());
+        for (const string& query : {"cat dog"s, "city -tail"s, "bird cat"s}) {
+            AssertSameDocuments(replayed.FindTopDocuments(query, DocumentStatus::ACTUAL, 100),
+                                expected.FindTopDocuments(query, DocumentStatus::ACTUAL, 100), query);
+        }
+    };
+
+    SearchServer expected("in"s);
+    {
+        SearchServer server("in"s);
+        server.OpenLog(log_path, {4, 2});
+        for (SearchServer* target : {&server, &expected}) {
+            for (int id = 0; id < 300; ++id) {
+                target->AddDocument(id, id % 2 ? "cat in city"s : "dog with tail"s,
+                                    DocumentStatus::ACTUAL, {id % 7});
+            }
+            target->AddDocuments({{300, "bird cat"s, DocumentStatus::ACTUAL, {1}},
+                                  {301, "bird dog"s, DocumentStatus::ACTUAL, {2}}});
+            // Removing 300 compacts the batch segment of one server only.
+            target->RemoveDocument(5);
+            target->RemoveDocument(300);
+        }
+    }
+    {
+        SearchServer replayed("in"s);
+        replayed.OpenLog(log_path);
+        assert_same_results(replayed, expected);
+
+        // Only the records newer than the saved index are replayed after it.
+        replayed.SaveIndex(index_path);
+        for (SearchServer* target : {&replayed, &expected}) {
+            target->AddDocument(400, "bird city"s, DocumentStatus::ACTUAL, {3});
+            target->RemoveDocument(6);
+        }
+    }
+    ASSERT_EQUAL(WriteAheadLog::ReadRecords(log_path).size(), 2u);
+
+    {
+        ofstream output(log_path, ios::binary | ios::app);
+        output << "torn record"s;
+    }
+    {
+        SearchServer reopened = SearchServer::OpenIndex(index_path);
+        reopened.OpenLog(log_path);
+        assert_same_results(reopened, expected);
+
+        // The torn tail is cut off, so new records follow the valid ones.
+        reopened.AddDocument(401, "cat"s, DocumentStatus::ACTUAL, {});
+        expected.AddDocument(401, "cat"s, DocumentStatus::ACTUAL, {});
+    }
+    {
+        SearchServer reopened = SearchServer::OpenIndex(index_path);
+        reopened.OpenLog(log_path);
+        assert_same_results(reopened, expected);
+    }
+}
+
+void TestWriteAheadLogFlushesAfterMaxDelay() {
+    const TemporaryDirectory directory;
+
+    // The group never fills, so only the deadline writes the records.
+    const string log_path = directory.GetPath("log"s);
+    SearchServer server({});
+    server.OpenLog(log_path, {100, 1, chrono::milliseconds(20)});
+    server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    server.RemoveDocument(1);
+    const auto give_up = chrono::steady_clock::now() + chrono::seconds(10);
+    while (WriteAheadLog::ReadRecords(log_path).size() < 2 && chrono::steady_clock::now() < give_up) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    ASSERT_EQUAL(WriteAheadLog::ReadRecords(log_path).size(), 2u);
+
+    // Without a deadline the records wait for the group or for SyncLog.
+    const string waiting_log_path = directory.GetPath("waiting_log"s);
+    SearchServer waiting_server({});
+    waiting_server.OpenLog(waiting_log_path, {100, 1, chrono::milliseconds(0)});
+    waiting_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    this_thread::sleep_for(chrono::milliseconds(50));
+    ASSERT(WriteAheadLog::ReadRecords(waiting_log_path).empty());
+    waiting_server.SyncLog();
+    ASSERT_EQUAL(WriteAheadLog::ReadRecords(waiting_log_path).size(), 1u);
+}
+
+void TestWriteAheadLogWriteFailure() {
+    const TemporaryDirectory directory;
+    const string log_path = directory.GetPath("log"s);
+    const auto get_file_size = [](const string& path) {
+        return static_cast<size_t>(ifstream(path, ios::binary | ios::ate).tellg());
+    };
+
+    // A file size limit makes the group write stop partway with EFBIG.
+    rlimit limit;
+    ASSERT(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+    const auto handler = signal(SIGXFSZ, SIG_IGN);
+    {
+        WriteAheadLog log(log_path, {1, 0}, 0);
+        log.AppendAdd(1, "cat in city"s, DocumentStatus::ACTUAL, {1});
+        const size_t valid_size = get_file_size(log_path);
+
+        rlimit small_limit = limit;
+        small_limit.rlim_cur = valid_size + 16;
+        ASSERT(setrlimit(RLIMIT_FSIZE, &small_limit) == 0);
+        try {
+            log.AppendAdd(2, string(100, 'a'), DocumentStatus::ACTUAL, {2});
+            ASSERT_HINT(false, "failed write must be reported"s);
+        } catch (const runtime_error&) {
+        }
+        ASSERT(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        ASSERT_EQUAL(get_file_size(log_path), valid_size);
+
+        try {
+            log.AppendRemove(1);
+            ASSERT_HINT(false, "failed log must reject writes"s);
+        } catch (const runtime_error&) {
+        }
+        try {
+            log.Sync();
+            ASSERT_HINT(false, "failed log must reject syncs"s);
+        } catch (const runtime_error&) {
+        }
+    }
+
+    // The first record of the batch fits under the limit and is written,
+    // the second is not; the batch fails, so neither may be replayed.
+    const string server_log_path = directory.GetPath("server_log"s);
+    {
+        SearchServer server({});
+        server.OpenLog(server_log_path);
+        server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+        const size_t record_size = get_file_size(server_log_path);
+
+        rlimit small_limit = limit;
+        small_limit.rlim_cur = 2 * record_size + 8;
+        ASSERT(setrlimit(RLIMIT_FSIZE, &small_limit) == 0);
+        try {
+            server.AddDocuments({{2, "cat"sv, DocumentStatus::ACTUAL, {1}},
+                                 {3, "cat"sv, DocumentStatus::ACTUAL, {1}}});
+            ASSERT_HINT(false, "failed log write must fail the batch"s);
+        } catch (const runtime_error&) {
+        }
+        ASSERT(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        ASSERT_EQUAL(server.GetDocumentCount(), 1);
+        ASSERT_EQUAL(get_file_size(server_log_path), record_size);
+    }
+    signal(SIGXFSZ, handler);
+
+    for (const string& path : {log_path, server_log_path}) {
+        const auto records = WriteAheadLog::ReadRecords(path);
+        ASSERT_EQUAL_HINT(records.size(), 1u, path);
+        ASSERT_EQUAL_HINT(records[0].document_id, 1, path);
+    }
+}
+
+void TestSplitIntoWords() {
+    ASSERT(SplitIntoWords(""s).empty());
+    ASSERT(SplitIntoWords("   "s).empty());
+    ASSERT((SplitIntoWords("  cat  in the city "s) == vector<string_view>{"cat"sv, "in"sv, "the"sv, "city"sv}));
+
+    // Lengths around the vector widths, with spaces and control characters
+    // at every position.
+    mt19937 generator(5);
+    const string alphabet = "ab \t\x80"s;
+    for (size_t length = 0; length < 100; ++length) {
+        string text;
+        for (size_t i = 0; i < length; ++i) {
+            text += alphabet[generator() % alphabet.size()];
+        }
+
+        vector<string_view> expected;
+        string_view invalid_word;
+        size_t start = 0;
+        for (size_t i = 0; i <= text.size(); ++i) {
+            if (i == text.size() || text[i] == ' ') {
+                if (i > start) {
+                    const string_view word = string_view(text).substr(start, i - start);
+                    expected.push_back(word);
+                    if (invalid_word.empty() && word.find('\t') != word.npos) {
+                        invalid_word = word;
+                    }
+                }
+                start = i + 1;
+            }
+        }
+
+        ASSERT_HINT(SplitIntoWords(text) == expected, text);
+        try {
+            ASSERT_HINT(SplitIntoValidWords(text) == expected, text);
+            ASSERT_HINT(invalid_word.empty(), text);
+        } catch (const invalid_argument& error) {
+            ASSERT_EQUAL_HINT(string(error.what()), "word is invalid: "s + string(invalid_word), text);
+        }
+    }
+}
+
+void TestIdfCache() {
+    IdfCache cache;
+    int compute_count = 0;
+    const auto get = [&](int term_id, uint64_t epoch, double value) {
+        return cache.Get(term_id, epoch, [&compute_count, value] {
+            ++compute_count;
+            return value;
+        });
+    };
+
+    ASSERT_EQUAL(get(3, 5, 1.5), 1.5);
+    ASSERT_EQUAL(get(3, 5, 0.0), 1.5);
+    ASSERT_EQUAL(compute_count, 1);
+
+    // A query on an older snapshot computes its own value and leaves the
+    // newer one cached.
+    ASSERT_EQUAL(get(3, 4, 2.5), 2.5);
+    ASSERT_EQUAL(get(3, 5, 0.0), 1.5);
+    ASSERT_EQUAL(compute_count, 2);
+
+    ASSERT_EQUAL(get(3, 6, 3.5), 3.5);
+    ASSERT_EQUAL(get(1000, 6, 4.5), 4.5);
+    ASSERT_EQUAL(get(3, 6, 0.0), 3.5);
+    ASSERT_EQUAL(compute_count, 4);
+}
+
+void TestResultCache() {
+    SearchServer server("in the"s);
+    for (int id = 0; id < 100; ++id) {
+        server.AddDocument(id, id % 3 ? "cat in the city"s : "dog with tail"s,
+                           static_cast<DocumentStatus>(id % 2), {id});
+    }
+
+    const auto find_uncached = [&server](const string& query, DocumentStatus document_status) {
+        return server.FindTopDocuments(
+            query,
+            [document_status](int document_id, DocumentStatus status, int rating) {
+                return status == document_status;
+            },
+            10);
+    };
+
+    const auto first = server.FindTopDocuments("cat -tail"s, DocumentStatus::ACTUAL, 10);
+    ASSERT_EQUAL(server.GetResultCacheStats().hits, 0u);
+    ASSERT_EQUAL(server.GetResultCacheStats().misses, 1u);
+
+    // Word order, repeated words and stop words do not change the key.
+    AssertSameDocuments(server.FindTopDocuments("-tail the cat cat"s, DocumentStatus::ACTUAL, 10), first);
+    AssertSameDocuments(server.FindTopDocuments(execution::par, "cat -tail"s, DocumentStatus::ACTUAL, 10),
+                        first);
+    ASSERT_EQUAL(server.GetResultCacheStats().hits, 2u);
+
+    // Status and size are part of the key.
+    AssertSameDocuments(server.FindTopDocuments("cat -tail"s, DocumentStatus::IRRELEVANT, 10),
+                        find_uncached("cat -tail"s, DocumentStatus::IRRELEVANT));
+    server.FindTopDocuments("cat -tail"s, DocumentStatus::ACTUAL, 11);
+    ASSERT_EQUAL(server.GetResultCacheStats().hits, 2u);
+    ASSERT_EQUAL(server.GetResultCacheStats().misses, 3u);
+
+    // Adding and removing documents invalidates the results.
+    server.AddDocument(100, "cat"s, DocumentStatus::ACTUAL, {1000});
+    const auto added = server.FindTopDocuments("cat -tail"s, DocumentStatus::ACTUAL, 10);
+    ASSERT_EQUAL(added.front().id, 100);
+    AssertSameDocuments(added, find_uncached("cat -tail"s, DocumentStatus::ACTUAL));
+
+    server.RemoveDocument(100);
+    AssertSameDocuments(server.FindTopDocuments("cat -tail"s, DocumentStatus::ACTUAL, 10),
+                        find_uncached("cat -tail"s, DocumentStatus::ACTUAL));
+    ASSERT_EQUAL(server.GetResultCacheStats().hits, 2u);
+    ASSERT_EQUAL(server.GetResultCacheStats().misses, 5u);
+}
+
+void TestRequestQueueWindow() {
+    SearchServer server(""s);
+    server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {});
+
+    RequestQueue::Clock::time_point now;
+    RequestQueue queue(server, chrono::seconds(10), [&now] { return now; });
+
+    for (int second = 0; second < 5; ++second) {
+        queue.AddFindRequest("dog"s);
+        queue.AddFindRequest("dog"s);
+        queue.AddFindRequest("cat"s);
+        now += chrono::seconds(1);
+    }
+    ASSERT_EQUAL(queue.GetNoResultRequests(), 10);
+
+    // Seconds older than the horizon drop out as the ring turns.
+    now += chrono::seconds(6);
+    ASSERT_EQUAL(queue.GetNoResultRequests(), 6);
+    queue.AddFindRequest("dog"s, DocumentStatus::ACTUAL);
+    ASSERT_EQUAL(queue.GetNoResultRequests(), 7);
+    now += chrono::seconds(20);
+    ASSERT_EQUAL(queue.GetNoResultRequests(), 0);
+
+    const int thread_count = 4;
+    const int request_count = 500;
+    vector<thread> threads;
+    for (int i = 0; i < thread_count; ++i) {
+        threads.emplace_back([&queue] {
+            for (int request = 0; request < request_count; ++request) {
+                queue.AddFindRequest("dog"s);
+            }
+        });
+    }
+    for (thread& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQUAL(queue.GetNoResultRequests(), thread_count * request_count);
+}
+
+void TestQueryExecutor() {
+    SearchServer server("in"s);
+    for (int id = 0; id < 200; ++id) {
+        server.AddDocument(id, id % 2 ? "cat in city"s : "dog "s + to_string(id % 7),
+                           static_cast<DocumentStatus>(id % 3), {id});
+    }
+
+    const vector<string> queries = {"cat"s, "dog dog1"s, "city -cat"s, "dog3 cat"s, "bird"s};
+    {
+        QueryExecutor executor(server, 3, 2);
+        vector<future<vector<Document>>> results;
+        for (int i = 0; i < 20; ++i) {
+            const string& query = queries[i % queries.size()];
+            results.push_back(
+                executor.SubmitQuery(query, static_cast<DocumentStatus>(i % 3), 10).result);
+        }
+        for (int i = 0; i < 20; ++i) {
+            AssertSameDocuments(results[i].get(),
+                                server.FindTopDocuments(queries[i % queries.size()],
+                                                        static_cast<DocumentStatus>(i % 3), 10));
+        }
+
+        auto missed = executor
+                          .SubmitQuery("cat"s, DocumentStatus::ACTUAL, 10,
+                                       QueryExecutor::Clock::now() - chrono::seconds(1))
+                          .result;
+        try {
+            missed.get();
+            ASSERT_HINT(false, "query past its deadline must not run"s);
+        } catch (const QueryDeadlineExceeded&) {
+        }
+
+        auto invalid = executor.SubmitQuery("cat --dog"s).result;
+        try {
+            invalid.get();
+            ASSERT_HINT(false, "invalid query must fail"s);
+        } catch (const invalid_argument&) {
+        }
+    }
+
+    // Queries submitted before destruction are still answered.
+    vector<future<vector<Document>>> results;
+    {
+        QueryExecutor executor(server, 1, 100);
+        for (int i = 0; i < 50; ++i) {
+            if (auto submitted = executor.TrySubmitQuery("cat"s)) {
+                results.push_back(move(submitted->result));
+            }
+        }
+    }
+    ASSERT(!results.empty());
+    for (auto& result : results) {
+        ASSERT_EQUAL(result.get().size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    }
+}
+
+void TestQueryInSteps() {
+    const vector<string> dictionary = {"cat"s, "dog"s, "city"s, "tail"s, "in"s};
+    SearchServer server("in"s);
+    AddRandomDocuments(server, MakeRandomTexts(dictionary, 3000, 8, 5, 7));
+    server.WaitForMerges();
+
+    const auto find_uncached = [&server](const string& query, size_t top_k) {
+        return server.FindTopDocuments(
+            query,
+            [](int document_id, DocumentStatus status, int rating) {
+                return status == DocumentStatus::ACTUAL;
+            },
+            top_k);
+    };
+
+    for (const string& query : {"cat1 dog2"s, "city3 -tail4"s, "bird"s}) {
+        // The first run of a query is not cached and takes many steps.
+        for (size_t step_postings : {50, 0, 1000000}) {
+            for (size_t top_k : {5, 5000}) {
+                auto stepper = server.StartQuery(query, DocumentStatus::ACTUAL, top_k, step_postings);
+                int step_count = 0;
+                while (!stepper.Step()) {
+                    ++step_count;
+                }
+                if (step_postings == 50 && query != "bird"s) {
+                    ASSERT(step_count > 10);
+                }
+                AssertSameDocuments(stepper.GetResult(), find_uncached(query, top_k));
+            }
+        }
+    }
+
+    QueryExecutor executor(server, 2, 4, 50);
+    vector<future<vector<Document>>> results;
+    for (int i = 0; i < 10; ++i) {
+        results.push_back(executor
+                              .SubmitQuery("tail"s + to_string(i % 5) + " dog1"s,
+                                           DocumentStatus::ACTUAL, 20)
+                              .result);
+    }
+    for (int i = 0; i < 10; ++i) {
+        AssertSameDocuments(results[i].get(), find_uncached("tail"s + to_string(i % 5) + " dog1"s, 20));
+    }
+
+    // Each of these takes thousands of steps, so cancelling right away
+    // drops all but the few already near their end.
+    QueryExecutor slow_executor(server, 2, 16, 1);
+    vector<QueryExecutor::SubmittedQuery> submitted;
+    for (int i = 0; i < 10; ++i) {
+        submitted.push_back(slow_executor.SubmitQuery("cat"s + to_string(i % 5) + " dog1"s,
+                                                      DocumentStatus::ACTUAL, 20));
+    }
+    for (const auto& query : submitted) {
+        query.cancellation.Cancel();
+    }
+    int cancelled_count = 0;
+    for (int i = 0; i < 10; ++i) {
+        try {
+            AssertSameDocuments(submitted[i].result.get(),
+                                  find_uncached("cat"s + to_string(i % 5) + " dog1"s, 20));
+        } catch (const QueryCancelled&) {
+            ++cancelled_count;
+        }
+    }
+    ASSERT(cancelled_count > 0);
+}
+
+void TestPaginator() {
+    const vector<int> numbers = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+    const auto pages = Paginate(numbers, 3);
+    ASSERT_EQUAL(pages.size(), 4u);
+    ASSERT_EQUAL(pages[1].size(), 3u);
+    ASSERT_EQUAL(*pages[1].begin(), 4);
+    ASSERT_EQUAL(pages[3].size(), 1u);
+    ASSERT_EQUAL(*pages[3].begin(), 10);
+    ASSERT(pages[4].begin() == numbers.end());
+
+    // Pages of a list are walked one by one and hold the same elements.
+    const list<int> linked(numbers.begin(), numbers.end());
+    vector<size_t> sizes;
+    vector<int> elements;
+    for (const auto& page : Paginate(linked, 3)) {
+        sizes.push_back(page.size());
+        elements.insert(elements.end(), page.begin(), page.end());
+    }
+    ASSERT((sizes == vector<size_t>{3, 3, 3, 1}));
+    ASSERT(elements == numbers);
+
+    ASSERT(Paginate(vector<int>(), 3).empty());
+    ASSERT_EQUAL(Paginate(vector<int>(), 3).size(), 0u);
+    ASSERT_EQUAL(Paginate(numbers, 10).size(), 1u);
+    try {
+        Paginate(numbers, 0);
+        ASSERT_HINT(false, "zero page size must be rejected"s);
+    } catch (const invalid_argument&) {
+    }
+}
+
 /*
 Разместите код остальных тестов здесь
 */
@@ -204,13 +1690,53 @@ void TestSearchServer() {
     RUN_TEST(TestSearchByStatus);
     RUN_TEST(TestMatchDocumentReturnActialStatus);
     RUN_TEST(TestMatchDocumentCheckMinusWords);
+    RUN_TEST(TestAddDocumentsInAnyIdOrder);
+    RUN_TEST(TestMatchDocumentReturnsSortedWords);
+    RUN_TEST(TestAddDocumentFromTemporaryBuffer);
+    RUN_TEST(TestFindTopDocumentsWithCustomCount);
+    RUN_TEST(TestNestedQueryInPredicate);
+    RUN_TEST(TestRelevanceUpdatedAfterAddDocument);
+    RUN_TEST(TestPrunedSearchMatchesExhaustiveSearch);
+    RUN_TEST(TestSearchOverManyPostingBlocks);
+    RUN_TEST(TestSealedSegmentCompressesTails);
+    RUN_TEST(TestParallelSearchMatchesSequentialSearch);
+    RUN_TEST(TestProcessQueries);
+    RUN_TEST(TestSearchWhileAddingDocuments);
+    RUN_TEST(TestSearchAcrossMergedSegments);
+    RUN_TEST(TestRemoveDocument);
+    RUN_TEST(TestRemovalKeepsDocumentIdsInOrder);
+    RUN_TEST(TestCompactionPurgesRemovedDocuments);
+    RUN_TEST(TestRemovalKeepsRunningQuerySnapshot);
+    RUN_TEST(TestGetWordFrequencies);
+    RUN_TEST(TestParallelMatchDocument);
+    RUN_TEST(TestAddDocumentsMatchesAddDocument);
+    RUN_TEST(TestAddDocumentsIsAllOrNothing);
+    RUN_TEST(TestSegmentCountStaysLogarithmic);
+    RUN_TEST(TestAddDocumentCostDoesNotGrowWithBuffer);
+    RUN_TEST(TestSaveAndOpenIndex);
+    RUN_TEST(TestCrc32);
+    RUN_TEST(TestOpenCorruptedIndex);
+    RUN_TEST(TestValidImageChecksBlockBounds);
+    RUN_TEST(TestPostingListsAreCheckedOnFirstRead);
+    RUN_TEST(TestWriteAheadLogReplay);
+    RUN_TEST(TestWriteAheadLogFlushesAfterMaxDelay);
+    RUN_TEST(TestWriteAheadLogWriteFailure);
+    RUN_TEST(TestSplitIntoWords);
+    RUN_TEST(TestIdfCache);
+    RUN_TEST(TestResultCache);
+    RUN_TEST(TestRequestQueueWindow);
+    RUN_TEST(TestQueryExecutor);
+    RUN_TEST(TestQueryInSteps);
+    RUN_TEST(TestPaginator);
 }
 
 int main() {
     TestSearchServer();
 
     SearchServer search_server("and in at"s);
-    RequestQueue request_queue(search_server);
+    // Запросы поступают раз в минуту
+    RequestQueue::Clock::time_point now;
+    RequestQueue request_queue(search_server, chrono::hours(24), [&now] { return now; });
     search_server.AddDocument(1, "curly cat curly tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
     search_server.AddDocument(2, "curly dog and fancy collar"s, DocumentStatus::ACTUAL, {1, 2, 3});
     search_server.AddDocument(3, "big cat fancy collar "s, DocumentStatus::ACTUAL, {1, 2, 8});
@@ -218,13 +1744,17 @@ int main() {
     search_server.AddDocument(5, "big dog sparrow Vasiliy"s, DocumentStatus::ACTUAL, {1, 1, 1});
     // 1439 запросов с нулевым результатом
     for (int i = 0; i < 1439; ++i) {
+        now += chrono::minutes(1);
         request_queue.AddFindRequest("empty request"s);
     }
     // все еще 1439 запросов с нулевым результатом
+    now += chrono::minutes(1);
     request_queue.AddFindRequest("curly dog"s);
     // новые сутки, первый запрос удален, 1438 запросов с нулевым результатом
+    now += chrono::minutes(1);
     request_queue.AddFindRequest("big collar"s);
     // первый запрос удален, 1437 запросов с нулевым результатом
+    now += chrono::minutes(1);
     request_queue.AddFindRequest("sparrow"s);
     cout << "Total empty requests: "s << request_queue.GetNoResultRequests() << endl;
     return 0;
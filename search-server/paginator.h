@@ -1,8 +1,10 @@
 #pragma once
 
 #include <algorithm>
+#include <cstddef>
 #include <iterator>
-#include <vector>
+#include <stdexcept>
+#include <type_traits>
 
 template <typename Iterator>
 class IteratorRange {
@@ -22,32 +24,115 @@ class IteratorRange {
     size_t size_;
 };
 
+// Lazy view of a range split into pages of page_size elements; the last
+// page may be shorter. Construction is O(1), and page boundaries are found
+// only when a page is reached, so showing the first pages of a long range
+// costs no more than those pages. With random-access iterators the page
+// count and any page are available in O(1) as well.
+//
+// A page is walked once to find its end and again when it is read, so the
+// iterators must be forward iterators; single-pass ones such as
+// std::istream_iterator would hand out pages whose elements were consumed.
 template <typename Iterator>
 class Paginator {
+    using IteratorCategory = typename std::iterator_traits<Iterator>::iterator_category;
+
+    static_assert(std::is_base_of_v<std::forward_iterator_tag, IteratorCategory>,
+                  "pages need forward iterators, which can be walked more than once");
+
+    static constexpr bool IS_RANDOM_ACCESS =
+        std::is_base_of_v<std::random_access_iterator_tag, IteratorCategory>;
+
    public:
-    explicit Paginator(Iterator begin, Iterator end, size_t page_size) {
-        Iterator it = begin;
+    using Page = IteratorRange<Iterator>;
+
+    class PageIterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Page;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Page*;
+        using reference = const Page&;
+
+        PageIterator(Iterator begin, Iterator end, size_t page_size)
+            : page_(MakePage(begin, end, page_size)), end_(end), page_size_(page_size) {}
+
+        reference operator*() const { return page_; }
+
+        pointer operator->() const { return &page_; }
+
+        PageIterator& operator++() {
+            page_ = MakePage(page_.end(), end_, page_size_);
+            return *this;
+        }
+
+        PageIterator operator++(int) {
+            PageIterator previous = *this;
+            ++*this;
+            return previous;
+        }
 
-        while (it != end) {
-            Iterator p_begin = it;
+        bool operator==(const PageIterator& other) const {
+            return page_.begin() == other.page_.begin();
+        }
 
-            size_t size = std::min(page_size, size_t(distance(it, end)));
+        bool operator!=(const PageIterator& other) const { return !(*this == other); }
 
-            advance(it, size);
+       private:
+        Page page_;
+        Iterator end_;
+        size_t page_size_;
+    };
 
-            pages_.push_back(IteratorRange(p_begin, it, size));
+    explicit Paginator(Iterator begin, Iterator end, size_t page_size)
+        : begin_(begin), end_(end), page_size_(page_size) {
+        if (page_size == 0) {
+            throw std::invalid_argument("page size must be positive");
         }
     }
 
-    auto begin() const { return pages_.begin(); }
+    PageIterator begin() const { return PageIterator(begin_, end_, page_size_); }
+
+    PageIterator end() const { return PageIterator(end_, end_, page_size_); }
+
+    bool empty() const { return begin_ == end_; }
 
-    auto end() const { return pages_.end(); }
+    // The page count and pages by number need random-access iterators.
+    size_t size() const {
+        static_assert(IS_RANDOM_ACCESS, "page count needs random-access iterators");
+        const size_t element_count = static_cast<size_t>(end_ - begin_);
+        return (element_count + page_size_ - 1) / page_size_;
+    }
+
+    Page operator[](size_t page) const {
+        static_assert(IS_RANDOM_ACCESS, "pages by number need random-access iterators");
+        const size_t element_count = static_cast<size_t>(end_ - begin_);
+        const size_t first = std::min(page * page_size_, element_count);
+        return MakePage(begin_ + first, end_, page_size_);
+    }
 
    private:
-    std::vector<IteratorRange<Iterator>> pages_;
+    Iterator begin_;
+    Iterator end_;
+    size_t page_size_;
+
+    // The page starting at begin, walking at most page_size elements.
+    static Page MakePage(Iterator begin, Iterator end, size_t page_size) {
+        Iterator page_end = begin;
+        size_t size = 0;
+        if constexpr (IS_RANDOM_ACCESS) {
+            size = std::min(page_size, static_cast<size_t>(end - begin));
+            page_end += size;
+        } else {
+            for (; size < page_size && page_end != end; ++size) {
+                ++page_end;
+            }
+        }
+        return Page(begin, page_end, size);
+    }
 };
 
 template <typename Container>
 auto Paginate(const Container& c, size_t page_size) {
     return Paginator(begin(c), end(c), page_size);
-}
\ No newline at end of file
+}
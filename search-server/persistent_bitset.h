@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Set of non-negative integers that is copied in O(1): a copy shares every
+// node with the original, and Set copies only the nodes on the path to its
+// bit that are still shared. The set is a trie of FANOUT-way nodes over
+// 64-bit words in which every inner node counts the set bits under each of
+// its children, so Set, Test and FindClear take O(log capacity). Copies may
+// be read concurrently, but a set must not be changed while it is read.
+class PersistentBitset {
+   public:
+    bool Test(size_t index) const {
+        if (index >= GetSpan(height_)) {
+            return false;
+        }
+        const Node* node = root_.get();
+        for (int height = height_; node != nullptr && height > 0; --height) {
+            node = node->children[index / GetSpan(height - 1) % FANOUT].get();
+        }
+        return node != nullptr && (node->values[index / 64 % FANOUT] >> (index % 64) & 1) != 0;
+    }
+
+    // Returns false if the integer is already in the set.
+    bool Set(size_t index) {
+        if (Test(index)) {
+            return false;
+        }
+        while (index >= GetSpan(height_)) {
+            if (root_) {
+                auto root = std::make_shared<Node>();
+                root->children.resize(FANOUT);
+                root->values[0] = count_;
+                root->children[0] = std::move(root_);
+                root_ = std::move(root);
+            }
+            ++height_;
+        }
+
+        std::shared_ptr<Node>* slot = &root_;
+        for (int height = height_; height > 0; --height) {
+            Node& node = Unshare(*slot, height);
+            const size_t child = index / GetSpan(height - 1) % FANOUT;
+            ++node.values[child];
+            slot = &node.children[child];
+        }
+        Unshare(*slot, 0).values[index / 64 % FANOUT] |= uint64_t{1} << (index % 64);
+        ++count_;
+        return true;
+    }
+
+    size_t Count() const { return count_; }
+
+    // The integer that is not in the set and has exactly n smaller integers
+    // not in the set.
+    size_t FindClear(size_t n) const {
+        const size_t capacity = GetSpan(height_);
+        if (n >= capacity - count_) {
+            return capacity + (n - (capacity - count_));
+        }
+
+        const Node* node = root_.get();
+        size_t base = 0;
+        for (int height = height_; node != nullptr && height > 0; --height) {
+            const size_t span = GetSpan(height - 1);
+            size_t child = 0;
+            for (; n >= span - node->values[child]; ++child) {
+                n -= span - node->values[child];
+            }
+            base += child * span;
+            node = node->children[child].get();
+        }
+        if (node == nullptr) {
+            return base + n;
+        }
+
+        for (size_t word = 0;; ++word) {
+            uint64_t clear_bits = ~node->values[word];
+            const auto clear_count = static_cast<size_t>(__builtin_popcountll(clear_bits));
+            if (n < clear_count) {
+                for (; n > 0; --n) {
+                    clear_bits &= clear_bits - 1;
+                }
+                return base + word * 64 + static_cast<size_t>(__builtin_ctzll(clear_bits));
+            }
+            n -= clear_count;
+        }
+    }
+
+   private:
+    static constexpr int BITS = 5;
+    static constexpr size_t FANOUT = size_t{1} << BITS;
+
+    struct Node {
+        // Words of bits in a leaf, set bits under each child in an inner node.
+        std::array<uint64_t, FANOUT> values{};
+        // FANOUT children in an inner node, none in a leaf.
+        std::vector<std::shared_ptr<Node>> children;
+    };
+
+    std::shared_ptr<Node> root_;
+    int height_ = 0;
+    size_t count_ = 0;
+
+    // Number of integers under a node of the given height; a leaf has height 0.
+    static size_t GetSpan(int height) { return FANOUT * 64 << (BITS * height); }
+
+    // The node in the slot, created if there is none and copied if another
+    // set shares it.
+    static Node& Unshare(std::shared_ptr<Node>& slot, int height) {
+        if (!slot) {
+            slot = std::make_shared<Node>();
+            if (height > 0) {
+                slot->children.resize(FANOUT);
+            }
+        } else if (slot.use_count() > 1) {
+            slot = std::make_shared<Node>(*slot);
+        } else {
+            // Reads through a set that released the node happened before.
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *slot;
+    }
+};
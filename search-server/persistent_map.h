@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Map from 32-bit keys to values that is copied in O(1): a copy shares every
+// node with the original, and a change copies only the nodes on the path to
+// its key that are still shared. The map is a trie over the bits of a hash
+// of the key, FANOUT children per level, whose leaves hold up to
+// LEAF_CAPACITY entries, so finding or changing a key takes O(log size).
+// Copies may be read concurrently, but a map must not be changed while it
+// is read.
+template <typename Value>
+class PersistentMap {
+   public:
+    // Returns nullptr if the key is not in the map.
+    const Value* Find(uint32_t key) const {
+        const uint64_t hash = Hash(key);
+        const Node* node = root_.get();
+        for (int shift = 0; node != nullptr && !node->IsLeaf(); shift += BITS) {
+            node = node->children[hash >> shift & MASK].get();
+        }
+        if (node == nullptr) {
+            return nullptr;
+        }
+        for (const auto& entry : node->entries) {
+            if (entry.first == key) {
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    // The value of the key, inserted as Value{} if the key is not in the map.
+    // The reference is valid until the map is changed.
+    Value& operator[](uint32_t key) {
+        const uint64_t hash = Hash(key);
+        std::shared_ptr<Node>* slot = &root_;
+        for (int shift = 0;; shift += BITS) {
+            Node& node = Unshare(*slot);
+            if (node.IsLeaf()) {
+                for (auto& entry : node.entries) {
+                    if (entry.first == key) {
+                        return entry.second;
+                    }
+                }
+                // The hash is a bijection, so a leaf below the last hash bit
+                // holds a single key and never needs splitting.
+                if (node.entries.size() < LEAF_CAPACITY || shift >= HASH_BITS) {
+                    ++size_;
+                    return node.entries.emplace_back(key, Value{}).second;
+                }
+                Split(node, shift);
+            }
+            slot = &node.children[hash >> shift & MASK];
+        }
+    }
+
+    // Returns false if the key is not in the map.
+    bool Erase(uint32_t key) {
+        if (Find(key) == nullptr) {
+            return false;
+        }
+        const uint64_t hash = Hash(key);
+        std::shared_ptr<Node>* slot = &root_;
+        for (int shift = 0; !(*slot)->IsLeaf(); shift += BITS) {
+            slot = &Unshare(*slot).children[hash >> shift & MASK];
+        }
+        auto& entries = Unshare(*slot).entries;
+        for (auto& entry : entries) {
+            if (entry.first == key) {
+                entry = std::move(entries.back());
+                entries.pop_back();
+                break;
+            }
+        }
+        --size_;
+        return true;
+    }
+
+    size_t size() const { return size_; }
+
+   private:
+    static constexpr int BITS = 5;
+    static constexpr int HASH_BITS = 32;
+    static constexpr size_t FANOUT = size_t{1} << BITS;
+    static constexpr uint64_t MASK = FANOUT - 1;
+    static constexpr size_t LEAF_CAPACITY = 8;
+
+    struct Node {
+        // FANOUT children in an inner node, none in a leaf.
+        std::vector<std::shared_ptr<Node>> children;
+        // Empty in an inner node.
+        std::vector<std::pair<uint32_t, Value>> entries;
+
+        bool IsLeaf() const { return children.empty(); }
+    };
+
+    std::shared_ptr<Node> root_;
+    size_t size_ = 0;
+
+    // The finalizer of MurmurHash3, which spreads neighbouring and sparse
+    // keys over the low bits the trie branches on first.
+    static uint64_t Hash(uint32_t key) {
+        key ^= key >> 16;
+        key *= 0x85ebca6bu;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35u;
+        key ^= key >> 16;
+        return key;
+    }
+
+    // The node in the slot, created if there is none and copied if another
+    // map shares it.
+    static Node& Unshare(std::shared_ptr<Node>& slot) {
+        if (!slot) {
+            slot = std::make_shared<Node>();
+        } else if (slot.use_count() > 1) {
+            slot = std::make_shared<Node>(*slot);
+        } else {
+            // Reads through a map that released the node happened before.
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *slot;
+    }
+
+    // Turns a full leaf at the given depth into an inner node.
+    static void Split(Node& node, int shift) {
+        node.children.resize(FANOUT);
+        for (auto& entry : node.entries) {
+            auto& child = node.children[Hash(entry.first) >> shift & MASK];
+            if (!child) {
+                child = std::make_shared<Node>();
+            }
+            child->entries.push_back(std::move(entry));
+        }
+        node.entries.clear();
+        node.entries.shrink_to_fit();
+    }
+};
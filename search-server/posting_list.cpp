@@ -0,0 +1,285 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "stream_vbyte.h"
+
+using namespace std;
+
+namespace {
+
+bool BlockLess(const PostingList::BlockBound& block, int ordinal) {
+    return block.last_ordinal < ordinal;
+}
+
+int GetBlockBase(const PostingList::Image& image, size_t block) {
+    return block == 0 ? 0 : image.blocks[block - 1].last_ordinal;
+}
+
+}  // namespace
+
+PostingList::PostingList(const Image& image) : image_(image), owns_image_(false) {}
+
+bool PostingList::IsValidImage(const Image& image, ArrayView<int> document_lengths) {
+    const size_t tail_size = image.tail_ordinals.size();
+    const size_t encoded_blocks = image.block_offsets.size();
+    if (image.tail_counts.size() != tail_size || tail_size >= BLOCK_SIZE ||
+        image.size < tail_size) {
+        return false;
+    }
+    const size_t encoded_size = image.size - tail_size;
+    if (encoded_blocks != (encoded_size + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+        (tail_size > 0 && encoded_size % BLOCK_SIZE != 0) ||
+        image.blocks.size() != encoded_blocks + (tail_size > 0 ? 1 : 0)) {
+        return false;
+    }
+    if (encoded_blocks > 0 && image.data.size() < STREAM_VBYTE_PADDING) {
+        return false;
+    }
+    const size_t data_end = image.data.size() - min(image.data.size(), STREAM_VBYTE_PADDING);
+
+    // Ordinals are summed in 64 bits, so crafted deltas cannot overflow.
+    const auto ordinal_limit = static_cast<int64_t>(document_lengths.size());
+    int64_t previous = -1;
+    double max_term_freq = 0.0;
+    array<uint32_t, 2 * BLOCK_SIZE> values;
+    for (size_t block = 0; block < image.blocks.size(); ++block) {
+        const size_t size = block < encoded_blocks
+                                ? min(BLOCK_SIZE, encoded_size - block * BLOCK_SIZE)
+                                : tail_size;
+        if (block < encoded_blocks) {
+            const size_t begin = image.block_offsets[block];
+            const size_t end =
+                block + 1 < encoded_blocks ? image.block_offsets[block + 1] : data_end;
+            if (begin > end || end > data_end || (2 * size + 3) / 4 > end - begin ||
+                GetStreamVByteLength(image.data.data() + begin, 2 * size) > end - begin) {
+                return false;
+            }
+            DecodeStreamVByte(image.data.data() + begin, 2 * size, values.data());
+        } else {
+            copy(image.tail_counts.begin(), image.tail_counts.end(), values.begin() + size);
+        }
+
+        int64_t ordinal = block == 0 ? 0 : image.blocks[block - 1].last_ordinal;
+        double block_max_term_freq = 0.0;
+        for (size_t i = 0; i < size; ++i) {
+            if (block < encoded_blocks) {
+                ordinal += values[i];
+            } else {
+                ordinal = image.tail_ordinals[i];
+            }
+            const uint32_t term_count = values[size + i];
+            if (ordinal <= previous || ordinal >= ordinal_limit || term_count == 0 ||
+                term_count > static_cast<uint32_t>(max(0, document_lengths[ordinal]))) {
+                return false;
+            }
+            previous = ordinal;
+            // The same expression as IndexSegment::GetTermFreq, so the
+            // recorded maxima match exactly.
+            block_max_term_freq = max(
+                block_max_term_freq, term_count / static_cast<double>(document_lengths[ordinal]));
+        }
+        if (image.blocks[block].last_ordinal != previous ||
+            image.blocks[block].max_term_freq != block_max_term_freq) {
+            return false;
+        }
+        max_term_freq = max(max_term_freq, block_max_term_freq);
+    }
+    return image.max_term_freq == max_term_freq;
+}
+
+PostingList::PostingList(const PostingList& other)
+    : storage_(other.storage_), image_(other.image_), owns_image_(other.owns_image_) {
+    UpdateImage();
+}
+
+PostingList::PostingList(PostingList&& other) noexcept
+    : storage_(move(other.storage_)), image_(other.image_), owns_image_(other.owns_image_) {
+    UpdateImage();
+}
+
+PostingList& PostingList::operator=(const PostingList& other) {
+    return *this = PostingList(other);
+}
+
+PostingList& PostingList::operator=(PostingList&& other) noexcept {
+    storage_ = move(other.storage_);
+    image_ = other.image_;
+    owns_image_ = other.owns_image_;
+    UpdateImage();
+    return *this;
+}
+
+void PostingList::UpdateImage() {
+    if (!owns_image_) {
+        return;
+    }
+    image_.data = storage_.data;
+    image_.block_offsets = storage_.block_offsets;
+    image_.blocks = storage_.blocks;
+    image_.tail_ordinals = storage_.tail_ordinals;
+    image_.tail_counts = storage_.tail_counts;
+}
+
+void PostingList::Add(int ordinal, uint32_t term_count, double term_freq) {
+    if (!owns_image_) {
+        throw logic_error("posting list made from an image is read-only");
+    }
+    if (IsSealed() && image_.size % BLOCK_SIZE != 0) {
+        throw logic_error("sealed posting list is read-only");
+    }
+
+    auto& blocks = storage_.blocks;
+    if (!blocks.empty() && blocks.back().last_ordinal >= ordinal) {
+        throw invalid_argument("postings must be added in increasing ordinal order");
+    }
+
+    if (storage_.tail_ordinals.empty()) {
+        blocks.push_back({ordinal, term_freq});
+    }
+
+    storage_.tail_ordinals.push_back(ordinal);
+    storage_.tail_counts.push_back(term_count);
+    ++image_.size;
+
+    BlockBound& block = blocks.back();
+    block.last_ordinal = ordinal;
+    block.max_term_freq = max(block.max_term_freq, term_freq);
+    image_.max_term_freq = max(image_.max_term_freq, term_freq);
+
+    if (storage_.tail_ordinals.size() == BLOCK_SIZE) {
+        FlushTail();
+    }
+    UpdateImage();
+}
+
+void PostingList::Seal() {
+    if (IsSealed()) {
+        return;
+    }
+    if (!owns_image_) {
+        storage_.data.assign(image_.data.begin(), image_.data.end());
+        storage_.block_offsets.assign(image_.block_offsets.begin(), image_.block_offsets.end());
+        storage_.blocks.assign(image_.blocks.begin(), image_.blocks.end());
+        storage_.tail_ordinals.assign(image_.tail_ordinals.begin(), image_.tail_ordinals.end());
+        storage_.tail_counts.assign(image_.tail_counts.begin(), image_.tail_counts.end());
+        owns_image_ = true;
+    }
+    FlushTail();
+    UpdateImage();
+}
+
+void PostingList::FlushTail() {
+    // Deltas of all postings of the block first, then all counts.
+    const size_t size = storage_.tail_ordinals.size();
+    array<uint32_t, 2 * BLOCK_SIZE> values;
+
+    auto& data = storage_.data;
+    int previous = GetBlockBase(image_, storage_.block_offsets.size());
+    for (size_t i = 0; i < size; ++i) {
+        values[i] = static_cast<uint32_t>(storage_.tail_ordinals[i] - previous);
+        values[size + i] = storage_.tail_counts[i];
+        previous = storage_.tail_ordinals[i];
+    }
+
+    data.resize(data.size() - min(data.size(), STREAM_VBYTE_PADDING));
+    storage_.block_offsets.push_back(static_cast<uint32_t>(data.size()));
+    EncodeStreamVByte(values.data(), 2 * size, data);
+    data.resize(data.size() + STREAM_VBYTE_PADDING, 0);
+
+    storage_.tail_ordinals.clear();
+    storage_.tail_counts.clear();
+}
+
+bool PostingList::Contains(int ordinal) const {
+    Cursor cursor(image_);
+    cursor.Seek(ordinal);
+    return cursor.Ordinal() == ordinal;
+}
+
+PostingList::Cursor::Cursor(const Image& image) : image_(image) { LoadBlock(0); }
+
+PostingList::Cursor::Cursor(const Cursor& other) { *this = other; }
+
+PostingList::Cursor& PostingList::Cursor::operator=(const Cursor& other) {
+    image_ = other.image_;
+    block_ = other.block_;
+    block_size_ = other.block_size_;
+    index_ = other.index_;
+    ordinal_ = other.ordinal_;
+    decoded_ordinals_ = other.decoded_ordinals_;
+    decoded_counts_ = other.decoded_counts_;
+    // A decoded block is read from the copy of the arrays.
+    const bool decoded = other.ordinals_ == other.decoded_ordinals_.data();
+    ordinals_ = decoded ? decoded_ordinals_.data() : other.ordinals_;
+    counts_ = decoded ? decoded_counts_.data() : other.counts_;
+    return *this;
+}
+
+void PostingList::Cursor::LoadBlock(size_t block) {
+    block_ = block;
+    index_ = 0;
+    if (block >= image_.blocks.size()) {
+        block_size_ = 0;
+        ordinal_ = END;
+        return;
+    }
+
+    if (block == image_.block_offsets.size()) {
+        ordinals_ = image_.tail_ordinals.data();
+        counts_ = image_.tail_counts.data();
+        block_size_ = image_.tail_ordinals.size();
+        ordinal_ = ordinals_[0];
+        return;
+    }
+
+    block_size_ = min(BLOCK_SIZE, image_.size - block * BLOCK_SIZE);
+    array<uint32_t, 2 * BLOCK_SIZE> values;
+    DecodeStreamVByte(image_.data.data() + image_.block_offsets[block], 2 * block_size_,
+                      values.data());
+
+    int ordinal = GetBlockBase(image_, block);
+    for (size_t i = 0; i < block_size_; ++i) {
+        ordinal += static_cast<int>(values[i]);
+        decoded_ordinals_[i] = ordinal;
+        decoded_counts_[i] = values[block_size_ + i];
+    }
+    ordinals_ = decoded_ordinals_.data();
+    counts_ = decoded_counts_.data();
+    ordinal_ = ordinals_[0];
+}
+
+size_t PostingList::Cursor::FindBlock(int ordinal) const {
+    const auto& blocks = image_.blocks;
+    const size_t current = min(block_, blocks.size());
+
+    return lower_bound(blocks.begin() + current, blocks.end(), ordinal, BlockLess) -
+           blocks.begin();
+}
+
+void PostingList::Cursor::Seek(int ordinal) {
+    if (ordinal_ >= ordinal) {
+        return;
+    }
+
+    const size_t block = FindBlock(ordinal);
+    if (block != block_) {
+        LoadBlock(block);
+        if (ordinal_ >= ordinal) {
+            return;
+        }
+    }
+
+    index_ = lower_bound(ordinals_ + index_, ordinals_ + block_size_, ordinal) - ordinals_;
+    ordinal_ = ordinals_[index_];
+}
+
+PostingList::BlockBound PostingList::Cursor::GetBlockBound(int ordinal) const {
+    const size_t block = FindBlock(ordinal);
+    if (block == image_.blocks.size()) {
+        return {END, 0.0};
+    }
+    return image_.blocks[block];
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "array_view.h"
+
+// Postings of one term sorted by document ordinal, stored in blocks of
+// BLOCK_SIZE. A full block is compressed with StreamVByte as ordinal deltas
+// followed by term counts; the last, partial block stays uncompressed until it
+// fills up, so Add is an append. Seal compresses that tail block too once no
+// more postings come, which matters because most lists are shorter than a
+// block. Every block remembers its last ordinal and maximum term frequency,
+// which lets cursors skip blocks during pruning.
+//
+// Reads go through an Image of the arrays, so a list can also be used in
+// place from memory it does not own, such as a mapped index file.
+class PostingList {
+   public:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    struct BlockBound {
+        int last_ordinal;
+        double max_term_freq;
+    };
+
+    // Everything a list reads: the encoded blocks followed by
+    // STREAM_VBYTE_PADDING zero bytes, their offsets, the bounds of the
+    // encoded blocks and, if it is not empty, of the tail block, and the
+    // tail block. Only the last encoded block may be shorter than
+    // BLOCK_SIZE, and only if the tail block is empty. The tail block of a
+    // list is shorter than BLOCK_SIZE; an image of postings kept elsewhere,
+    // such as in the write buffer, may have all of them in its tail.
+    struct Image {
+        size_t size = 0;
+        double max_term_freq = 0.0;
+        ArrayView<uint8_t> data;
+        ArrayView<uint32_t> block_offsets;
+        ArrayView<BlockBound> blocks;
+        ArrayView<int> tail_ordinals;
+        ArrayView<uint32_t> tail_counts;
+    };
+
+    // Walks the postings of an image, decoding one block at a time. The
+    // arrays of the image must outlive the cursor.
+    class Cursor {
+       public:
+        static constexpr int END = std::numeric_limits<int>::max();
+
+        explicit Cursor(const Image& image);
+
+        Cursor(const Cursor& other);
+
+        Cursor& operator=(const Cursor& other);
+
+        int Ordinal() const { return ordinal_; }
+
+        uint32_t TermCount() const { return counts_[index_]; }
+
+        void Next() {
+            if (++index_ < block_size_) {
+                ordinal_ = ordinals_[index_];
+            } else {
+                LoadBlock(block_ + 1);
+            }
+        }
+
+        // Moves to the first posting with an ordinal not less than the given one.
+        void Seek(int ordinal);
+
+        // Bound of the block holding the first posting at or after the given
+        // ordinal, or {END, 0.0} if there is no such posting.
+        BlockBound GetBlockBound(int ordinal) const;
+
+       private:
+        Image image_;
+        size_t block_ = 0;
+        size_t block_size_ = 0;
+        size_t index_ = 0;
+        int ordinal_ = END;
+        // Point into the decoded arrays, or into the image for the tail block.
+        const int* ordinals_ = nullptr;
+        const uint32_t* counts_ = nullptr;
+        std::array<int, BLOCK_SIZE> decoded_ordinals_;
+        std::array<uint32_t, BLOCK_SIZE> decoded_counts_;
+
+        void LoadBlock(size_t block);
+
+        size_t FindBlock(int ordinal) const;
+    };
+
+    PostingList() = default;
+
+    // The arrays of the image must outlive the list and its copies.
+    explicit PostingList(const Image& image);
+
+    // Checks an image from untrusted memory such as a file: its arrays agree
+    // with each other and with size, every block decodes within data, the
+    // postings have strictly increasing ordinals of the documents with the
+    // given lengths and nonzero counts up to those lengths, and the blocks
+    // and the list record the last ordinals and maximum term frequencies of
+    // their postings, so pruning never skips a document it should score.
+    // Only then can a list made from it be read.
+    static bool IsValidImage(const Image& image, ArrayView<int> document_lengths);
+
+    PostingList(const PostingList& other);
+
+    PostingList(PostingList&& other) noexcept;
+
+    PostingList& operator=(const PostingList& other);
+
+    PostingList& operator=(PostingList&& other) noexcept;
+
+    // Appends a posting; ordinals must be strictly increasing. term_freq is
+    // only used for the block-max bounds. Sealed lists and lists made from an
+    // image cannot be appended to.
+    void Add(int ordinal, uint32_t term_count, double term_freq);
+
+    // Compresses the tail block. A list made from an image is copied into
+    // memory of its own first if it has a tail to compress.
+    void Seal();
+
+    // True if no posting is left uncompressed.
+    bool IsSealed() const { return image_.tail_ordinals.empty(); }
+
+    bool Contains(int ordinal) const;
+
+    double GetMaxTermFreq() const { return image_.max_term_freq; }
+
+    Cursor GetCursor() const { return Cursor(image_); }
+
+    size_t size() const { return image_.size; }
+
+    const Image& GetImage() const { return image_; }
+
+   private:
+    // The arrays of a list built with Add; empty for a list made from an image.
+    struct Storage {
+        std::vector<uint8_t> data;
+        std::vector<uint32_t> block_offsets;
+        std::vector<BlockBound> blocks;
+        std::vector<int> tail_ordinals;
+        std::vector<uint32_t> tail_counts;
+    };
+
+    Storage storage_;
+    Image image_;
+    bool owns_image_ = true;
+
+    // Points the image at the storage after it has changed.
+    void UpdateImage();
+
+    void FlushTail();
+};
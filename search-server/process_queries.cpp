@@ -0,0 +1,47 @@
+#include "process_queries.h"
+
+#include <algorithm>
+#include <exception>
+#include <execution>
+#include <iterator>
+
+using namespace std;
+
+vector<vector<Document>> ProcessQueries(const SearchServer& search_server,
+                                        const vector<string>& queries) {
+    vector<vector<Document>> results(queries.size());
+    vector<exception_ptr> errors(queries.size());
+    for_each(execution::par, queries.begin(), queries.end(), [&](const string& query) {
+        const size_t i = &query - queries.data();
+        // Exceptions must not escape a parallel algorithm.
+        try {
+            results[i] = search_server.FindTopDocuments(query);
+        } catch (...) {
+            errors[i] = current_exception();
+        }
+    });
+
+    for (const exception_ptr& error : errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+    return results;
+}
+
+vector<Document> ProcessQueriesJoined(const SearchServer& search_server,
+                                      const vector<string>& queries) {
+    vector<vector<Document>> results = ProcessQueries(search_server, queries);
+
+    size_t total_size = 0;
+    for (const auto& documents : results) {
+        total_size += documents.size();
+    }
+
+    vector<Document> joined;
+    joined.reserve(total_size);
+    for (auto& documents : results) {
+        move(documents.begin(), documents.end(), back_inserter(joined));
+    }
+    return joined;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// Runs FindTopDocuments for every query in parallel on the standard library's
+// worker pool; the i-th result belongs to the i-th query. If queries throw,
+// all of them still run, and the exception of the first one is rethrown.
+std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server,
+                                                  const std::vector<std::string>& queries);
+
+// Same as ProcessQueries, but with all results concatenated in query order.
+std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server,
+                                           const std::vector<std::string>& queries);
@@ -0,0 +1,75 @@
+#include "query_executor.h"
+
+#include <algorithm>
+#include <exception>
+#include <utility>
+
+using namespace std;
+
+QueryExecutor::QueryExecutor(const SearchServer& search_server, size_t thread_count,
+                             size_t queue_capacity, size_t step_postings)
+    : search_server_(search_server), step_postings_(step_postings), tasks_(queue_capacity) {
+    thread_count = max<size_t>(1, thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back(&QueryExecutor::RunWorker, this);
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    tasks_.Close();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+QueryExecutor::SubmittedQuery QueryExecutor::SubmitQuery(string_view raw_query,
+                                                         DocumentStatus status, size_t top_k,
+                                                         Clock::time_point deadline) {
+    Task task{string(raw_query), status, top_k, deadline, {}, {}, nullopt};
+    SubmittedQuery submitted{task.result.get_future(), task.cancellation};
+    tasks_.Push(move(task));
+    return submitted;
+}
+
+optional<QueryExecutor::SubmittedQuery> QueryExecutor::TrySubmitQuery(string_view raw_query,
+                                                                      DocumentStatus status,
+                                                                      size_t top_k,
+                                                                      Clock::time_point deadline) {
+    Task task{string(raw_query), status, top_k, deadline, {}, {}, nullopt};
+    SubmittedQuery submitted{task.result.get_future(), task.cancellation};
+    if (!tasks_.TryPush(task)) {
+        return nullopt;
+    }
+    return submitted;
+}
+
+void QueryExecutor::RunWorker() {
+    while (auto task = tasks_.Pop()) {
+        if (task->cancellation.IsCancelled()) {
+            task->result.set_exception(make_exception_ptr(QueryCancelled()));
+            continue;
+        }
+        if (Clock::now() > task->deadline) {
+            task->result.set_exception(make_exception_ptr(QueryDeadlineExceeded()));
+            continue;
+        }
+        try {
+            if (step_postings_ == 0) {
+                task->result.set_value(
+                    search_server_.FindTopDocuments(task->raw_query, task->status, task->top_k));
+                continue;
+            }
+            if (!task->stepper) {
+                task->stepper = search_server_.StartQuery(task->raw_query, task->status,
+                                                          task->top_k, step_postings_);
+            }
+            if (!task->stepper->Step()) {
+                tasks_.Requeue(move(*task));
+                continue;
+            }
+            task->result.set_value(task->stepper->GetResult());
+        } catch (...) {
+            task->result.set_exception(current_exception());
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "document.h"
+#include "search_server.h"
+
+// Set on the future of a query that was still queued at its deadline.
+class QueryDeadlineExceeded : public std::runtime_error {
+   public:
+    QueryDeadlineExceeded() : std::runtime_error("query deadline exceeded") {}
+};
+
+// Set on the future of a query that was cancelled before it finished.
+class QueryCancelled : public std::runtime_error {
+   public:
+    QueryCancelled() : std::runtime_error("query cancelled") {}
+};
+
+// Cancels a submitted query. Copies refer to the same query, and cancelling
+// one that has already finished has no effect.
+class QueryCancellation {
+   public:
+    void Cancel() const { cancelled_->store(true, std::memory_order_release); }
+
+    bool IsCancelled() const { return cancelled_->load(std::memory_order_acquire); }
+
+   private:
+    std::shared_ptr<std::atomic<bool>> cancelled_ = std::make_shared<std::atomic<bool>>(false);
+};
+
+// Runs status queries asynchronously on a pool of worker threads fed by a
+// bounded queue. SubmitQuery blocks while the queue is full and
+// TrySubmitQuery gives up instead, so callers can shed load when the pool
+// saturates. Errors of FindTopDocuments are passed on through the future.
+//
+// With step_postings set, a worker runs one step of a query at a time (see
+// SearchServer::QueryStepper) and puts an unfinished query back at the end
+// of the queue, so short queries are not stuck behind long ones. A
+// cancelled query is dropped before its next step, or before it starts when
+// it runs in one go.
+class QueryExecutor {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    struct SubmittedQuery {
+        std::future<std::vector<Document>> result;
+        QueryCancellation cancellation;
+    };
+
+    explicit QueryExecutor(const SearchServer& search_server,
+                           size_t thread_count = std::thread::hardware_concurrency(),
+                           size_t queue_capacity = 1024, size_t step_postings = 0);
+
+    // Completes the queries already submitted, then stops the workers.
+    ~QueryExecutor();
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    // A query that has not started by its deadline, or in steps has not
+    // finished by it, is dropped; its future throws QueryDeadlineExceeded.
+    // The future of a cancelled query throws QueryCancelled.
+    SubmittedQuery SubmitQuery(
+        std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t top_k = MAX_RESULT_DOCUMENT_COUNT,
+        Clock::time_point deadline = Clock::time_point::max());
+
+    // Returns nullopt instead of waiting when the queue is full.
+    std::optional<SubmittedQuery> TrySubmitQuery(
+        std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t top_k = MAX_RESULT_DOCUMENT_COUNT,
+        Clock::time_point deadline = Clock::time_point::max());
+
+   private:
+    struct Task {
+        std::string raw_query;
+        DocumentStatus status;
+        size_t top_k;
+        Clock::time_point deadline;
+        std::promise<std::vector<Document>> result;
+        QueryCancellation cancellation;
+        // Set once a query run in steps has started.
+        std::optional<SearchServer::QueryStepper> stepper;
+    };
+
+    const SearchServer& search_server_;
+    const size_t step_postings_;
+    BoundedQueue<Task> tasks_;
+    std::vector<std::thread> workers_;
+
+    void RunWorker();
+};
@@ -20,7 +20,7 @@ template <typename Term>
 std::ostream& operator<<(std::ostream& os, const std::vector<Term>& terms) {
     os << "[";
     bool is_first = true;
-    for (const std::string& term : terms) {
+    for (const Term& term : terms) {
         if (is_first) {
             os << term;
             is_first = false;
@@ -36,7 +36,7 @@ template <typename Term>
 std::ostream& operator<<(std::ostream& os, const std::set<Term>& terms) {
     os << "{";
     bool is_first = true;
-    for (const std::string& term : terms) {
+    for (const Term& term : terms) {
         if (is_first) {
             os << term;
             is_first = false;
@@ -1,22 +1,62 @@
 #include "request_queue.h"
 
+#include <algorithm>
 #include <vector>
 
 using namespace std;
 
-RequestQueue::RequestQueue(const SearchServer& search_server) : search_server_(search_server) {}
+RequestQueue::RequestQueue(const SearchServer& search_server, chrono::seconds horizon,
+                           function<Clock::time_point()> now)
+    : search_server_(search_server),
+      now_(move(now)),
+      start_(now_()),
+      buckets_(max<chrono::seconds::rep>(1, horizon.count())) {}
 
-vector<Document> RequestQueue::AddFindRequest(const string& raw_query,
+vector<Document> RequestQueue::AddFindRequest(string_view raw_query,
                                               DocumentStatus status) {
-    return AddFindRequest(
-        raw_query, [status](int document_id, DocumentStatus document_status,
-                            int rating) { return document_status == status; });
+    auto documents = search_server_.FindTopDocuments(raw_query, status);
+    Record(documents);
+    return documents;
 }
 
-vector<Document> RequestQueue::AddFindRequest(const string& raw_query) {
+vector<Document> RequestQueue::AddFindRequest(string_view raw_query) {
     return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
 }
 
 int RequestQueue::GetNoResultRequests() const {
-    return no_result_requests_count_;
-}
\ No newline at end of file
+    const uint64_t second = GetSecond();
+
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+        const uint64_t state = bucket.load(memory_order_relaxed);
+        if (second - (state >> 32) < buckets_.size()) {
+            total += static_cast<uint32_t>(state);
+        }
+    }
+    return static_cast<int>(total);
+}
+
+uint32_t RequestQueue::GetSecond() const {
+    const auto elapsed = chrono::duration_cast<chrono::seconds>(now_() - start_).count();
+    return static_cast<uint32_t>(max<chrono::seconds::rep>(0, elapsed));
+}
+
+void RequestQueue::Record(const vector<Document>& documents) {
+    if (!documents.empty()) {
+        return;
+    }
+
+    const uint64_t second = GetSecond();
+    auto& bucket = buckets_[second % buckets_.size()];
+
+    uint64_t state = bucket.load(memory_order_relaxed);
+    uint64_t next;
+    do {
+        const uint64_t bucket_second = state >> 32;
+        if (bucket_second > second) {
+            // The ring has moved on while this thread was stalled.
+            return;
+        }
+        next = bucket_second == second ? state + 1 : (second << 32) | 1;
+    } while (!bucket.compare_exchange_weak(state, next, memory_order_relaxed));
+}
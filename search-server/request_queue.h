@@ -1,63 +1,60 @@
 #pragma once
 
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
 #include <vector>
 
 #include "document.h"
 #include "search_server.h"
 
+// Counts requests without results over a sliding window of wall-clock
+// time. The window is a ring of per-second buckets, so memory depends on
+// the horizon only, and requests are recorded with a compare-and-swap
+// without locks, so any number of threads can share a queue.
 class RequestQueue {
    public:
-    explicit RequestQueue(const SearchServer& search_server);
+    using Clock = std::chrono::steady_clock;
+
+    // The clock is only replaced by tests.
+    explicit RequestQueue(const SearchServer& search_server,
+                          std::chrono::seconds horizon = std::chrono::hours(24),
+                          std::function<Clock::time_point()> now = Clock::now);
 
     template <typename DocumentPredicate>
-    std::vector<Document> AddFindRequest(const std::string& raw_query,
+    std::vector<Document> AddFindRequest(std::string_view raw_query,
                                          DocumentPredicate document_predicate);
 
-    std::vector<Document> AddFindRequest(const std::string& raw_query,
+    std::vector<Document> AddFindRequest(std::string_view raw_query,
                                          DocumentStatus status);
 
-    std::vector<Document> AddFindRequest(const std::string& raw_query);
+    std::vector<Document> AddFindRequest(std::string_view raw_query);
 
+    // Requests without results during the last horizon seconds.
     int GetNoResultRequests() const;
 
    private:
-    struct QueryResult {
-        uint64_t execution_time;
-        std::vector<Document> documents;
-    };
-    std::deque<QueryResult> requests_;
-    const static int min_in_day_ = 1440;
-
     const SearchServer& search_server_;
+    std::function<Clock::time_point()> now_;
+    Clock::time_point start_;
+
+    // A bucket holds the second it counts in the high half and the count in
+    // the low half, so a bucket left from an earlier turn of the ring is
+    // recognized and restarted by the same compare-and-swap.
+    std::vector<std::atomic<uint64_t>> buckets_;
 
-    int no_result_requests_count_ = 0;
+    // Seconds since the queue was created.
+    uint32_t GetSecond() const;
 
-    uint64_t current_time_ = 0;
+    void Record(const std::vector<Document>& documents);
 };
 
 template <typename DocumentPredicate>
-std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query,
+std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query,
                                                    DocumentPredicate document_predicate) {
-    ++current_time_;
-
-    if (!requests_.empty() &&
-        current_time_ - requests_.front().execution_time >= min_in_day_) {
-        if (requests_.front().documents.empty()) {
-            --no_result_requests_count_;
-        }
-
-        requests_.pop_front();
-    }
-
-    auto documents =
-        search_server_.FindTopDocuments(raw_query, document_predicate);
-
-    if (documents.empty()) {
-        ++no_result_requests_count_;
-    }
-
-    requests_.push_back({current_time_, documents});
-
+    auto documents = search_server_.FindTopDocuments(raw_query, document_predicate);
+    Record(documents);
     return documents;
-}
\ No newline at end of file
+}
@@ -0,0 +1,79 @@
+#include "result_cache.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+void CombineHash(size_t& seed, size_t value) {
+    seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+}  // namespace
+
+size_t ResultCache::KeyHash::operator()(const Key& key) const {
+    size_t seed = key.plus_terms.size();
+    for (int term_id : key.plus_terms) {
+        CombineHash(seed, hash<int>{}(term_id));
+    }
+    // Tells {a}, {b} from {a, b}, {}.
+    CombineHash(seed, key.minus_terms.size());
+    for (int term_id : key.minus_terms) {
+        CombineHash(seed, hash<int>{}(term_id));
+    }
+    CombineHash(seed, hash<int>{}(key.status));
+    CombineHash(seed, hash<size_t>{}(key.top_k));
+    return seed;
+}
+
+ResultCache::ResultCache(size_t capacity, size_t shard_count)
+    : shard_capacity_(max<size_t>(1, capacity / max<size_t>(1, shard_count))),
+      shards_(max<size_t>(1, shard_count)) {}
+
+ResultCache::Shard& ResultCache::GetShard(const Key& key) {
+    // The low bits feed the bucket index of the shard's own map.
+    return shards_[(KeyHash{}(key) >> 16) % shards_.size()];
+}
+
+optional<vector<Document>> ResultCache::Find(const Key& key, uint64_t epoch) {
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+
+    const auto position = shard.positions.find(key);
+    if (position == shard.positions.end() || position->second->epoch != epoch) {
+        misses_.fetch_add(1, memory_order_relaxed);
+        return nullopt;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, position->second);
+    hits_.fetch_add(1, memory_order_relaxed);
+    return position->second->documents;
+}
+
+void ResultCache::Insert(const Key& key, uint64_t epoch, const vector<Document>& documents) {
+    Shard& shard = GetShard(key);
+    lock_guard guard(shard.mutex);
+
+    const auto position = shard.positions.find(key);
+    if (position != shard.positions.end()) {
+        Entry& entry = *position->second;
+        if (entry.epoch <= epoch) {
+            entry.epoch = epoch;
+            entry.documents = documents;
+        }
+        shard.entries.splice(shard.entries.begin(), shard.entries, position->second);
+        return;
+    }
+
+    if (shard.entries.size() == shard_capacity_) {
+        shard.positions.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front({key, epoch, documents});
+    shard.positions.emplace(key, shard.entries.begin());
+}
+
+ResultCache::Stats ResultCache::GetStats() const {
+    return {hits_.load(memory_order_relaxed), misses_.load(memory_order_relaxed)};
+}
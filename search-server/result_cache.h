@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+// Bounded cache of top-k results of status queries. Keys are normalized
+// queries, so word order, repeated words and stop words do not matter.
+// Every entry remembers the index epoch it was computed at and is a miss
+// at any other epoch. The cache is split into shards with their own lock
+// and least-recently-used list, so concurrent queries rarely contend.
+class ResultCache {
+   public:
+    struct Key {
+        // Sorted and deduplicated term ids.
+        std::vector<int> plus_terms;
+        std::vector<int> minus_terms;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        size_t top_k = 0;
+
+        bool operator==(const Key& other) const {
+            return plus_terms == other.plus_terms && minus_terms == other.minus_terms &&
+                   status == other.status && top_k == other.top_k;
+        }
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        double GetHitRate() const {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+        }
+    };
+
+    // The capacity is split evenly between the shards.
+    ResultCache(size_t capacity, size_t shard_count);
+
+    std::optional<std::vector<Document>> Find(const Key& key, uint64_t epoch);
+
+    // Keeps the entry of the later epoch if the key is already cached.
+    void Insert(const Key& key, uint64_t epoch, const std::vector<Document>& documents);
+
+    Stats GetStats() const;
+
+   private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry {
+        Key key;
+        uint64_t epoch;
+        std::vector<Document> documents;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> entries;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> positions;
+    };
+
+    size_t shard_capacity_;
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    Shard& GetShard(const Key& key);
+};
@@ -0,0 +1,42 @@
+#include "score_accumulator.h"
+
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+vector<unique_ptr<ScoreAccumulator>>& ThreadLocalPool() {
+    thread_local vector<unique_ptr<ScoreAccumulator>> pool;
+    return pool;
+}
+
+}  // namespace
+
+void ScoreAccumulator::Reset(size_t document_count) {
+    for (int ordinal : touched_) {
+        scores_[ordinal] = 0.0;
+        states_[ordinal] = UNTOUCHED;
+    }
+    touched_.clear();
+
+    if (scores_.size() < document_count) {
+        scores_.resize(document_count, 0.0);
+        states_.resize(document_count, UNTOUCHED);
+    }
+}
+
+PooledScoreAccumulator::PooledScoreAccumulator(size_t document_count) {
+    auto& pool = ThreadLocalPool();
+    if (pool.empty()) {
+        accumulator_ = make_unique<ScoreAccumulator>();
+    } else {
+        accumulator_ = move(pool.back());
+        pool.pop_back();
+    }
+    accumulator_->Reset(document_count);
+}
+
+PooledScoreAccumulator::~PooledScoreAccumulator() {
+    ThreadLocalPool().push_back(move(accumulator_));
+}
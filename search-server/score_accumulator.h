@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Scratch space for term-at-a-time scoring: relevance sums in a dense array
+// indexed by document ordinal, plus the list of touched ordinals so that the
+// next query only has to reset what this one used.
+class ScoreAccumulator {
+   public:
+    void Reset(size_t document_count);
+
+    void Add(int ordinal, double score) {
+        if (states_[ordinal] == UNTOUCHED) {
+            states_[ordinal] = SCORED;
+            touched_.push_back(ordinal);
+        }
+        scores_[ordinal] += score;
+    }
+
+    void Exclude(int ordinal) {
+        if (states_[ordinal] == UNTOUCHED) {
+            touched_.push_back(ordinal);
+        }
+        states_[ordinal] = EXCLUDED;
+    }
+
+    bool IsExcluded(int ordinal) const { return states_[ordinal] == EXCLUDED; }
+
+    // Calls visitor(ordinal, relevance) for every scored, not excluded document.
+    template <typename Visitor>
+    void ForEachScored(Visitor visitor) const {
+        for (int ordinal : touched_) {
+            if (states_[ordinal] == SCORED) {
+                visitor(ordinal, scores_[ordinal]);
+            }
+        }
+    }
+
+   private:
+    enum State : uint8_t { UNTOUCHED,
+                           SCORED,
+                           EXCLUDED };
+
+    std::vector<double> scores_;
+    std::vector<State> states_;
+    std::vector<int> touched_;
+};
+
+// Borrows an accumulator from a per-thread pool for the duration of a query.
+// Nested queries on the same thread (e.g. from a predicate) get their own.
+class PooledScoreAccumulator {
+   public:
+    explicit PooledScoreAccumulator(size_t document_count);
+
+    PooledScoreAccumulator(const PooledScoreAccumulator&) = delete;
+    PooledScoreAccumulator& operator=(const PooledScoreAccumulator&) = delete;
+
+    ~PooledScoreAccumulator();
+
+    ScoreAccumulator& operator*() { return *accumulator_; }
+
+    ScoreAccumulator* operator->() { return accumulator_.get(); }
+
+   private:
+    std::unique_ptr<ScoreAccumulator> accumulator_;
+};
@@ -1,12 +1,21 @@
 #include "search_server.h"
 
 #include <algorithm>
+#include <condition_variable>
 #include <cmath>
+#include <exception>
+#include <execution>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "string_processing.h"
@@ -16,79 +25,711 @@ using namespace std;
 SearchServer::SearchServer(const string& stop_words_text)
     : SearchServer(SplitIntoWords(stop_words_text)) {}
 
-void SearchServer::AddDocument(int document_id, const string& document,
+SearchServer::SearchServer(FromIndexFile, const IndexFileContents& contents)
+    : SearchServer(contents.stop_words) {
+    // The dictionary reads the terms in place from the mapped file.
+    if (!terms_.InternViews(contents.terms, contents.storage)) {
+        throw runtime_error("index file is corrupted");
+    }
+
+    auto index = make_shared<IndexSnapshot>();
+    index->segments.insert(index->segments.begin(),
+                           SegmentVersion{index->next_segment_serial++, contents.segment});
+    index->LocateDocuments(0);
+    index->term_count = static_cast<int>(terms_.size());
+    index->document_count = contents.segment->GetDocumentCount();
+    index->epoch = 1;
+    index->log_sequence = contents.log_sequence;
+    snapshot_ = move(index);
+}
+
+SearchServer SearchServer::OpenIndex(const string& path) {
+    auto contents = ReadIndexFile(path);
+    try {
+        return SearchServer(FromIndexFile{}, contents);
+    } catch (const invalid_argument&) {
+        // A stop word the constructor rejects can only come from a corrupted file.
+        throw runtime_error("index file is corrupted");
+    }
+}
+
+SearchServer::~SearchServer() {
+    {
+        lock_guard guard(merge_mutex_);
+        stopping_ = true;
+    }
+    merge_condition_.notify_all();
+    if (merger_.joinable()) {
+        merger_.join();
+    }
+}
+
+template <typename AppendRecords>
+void SearchServer::LogChange(IndexSnapshot& next, AppendRecords append_records) {
+    if (!log_) {
+        return;
+    }
+    const auto log_end = log_->GetEnd();
+    try {
+        next.log_sequence = append_records(*log_);
+    } catch (...) {
+        log_->RollBack(log_end);
+        throw;
+    }
+}
+
+void SearchServer::AddDocument(int document_id, string_view document,
                                DocumentStatus status, const vector<int>& ratings) {
     if (document_id < 0) {
         throw invalid_argument("attempt to add document with negative id");
     }
 
-    if (document_ratings_.count(document_id) > 0) {
+    const vector<string_view> words = SplitIntoWordsNoStop(document);
+
+    lock_guard guard(write_mutex_);
+    const auto current = GetSnapshot();
+
+    if (FindDocument(*current, document_id)) {
         throw invalid_argument("attempt to add document twice");
     }
 
-    const vector<string> words = SplitIntoWordsNoStop(document);
+    vector<int> terms;
+    terms.reserve(words.size());
+    for (string_view word : words) {
+        terms.push_back(terms_.Intern(word));
+    }
+
+    auto next = make_shared<IndexSnapshot>(*current);
+    LogChange(*next, [&](WriteAheadLog& log) {
+        return log.AppendAdd(document_id, document, status, ratings);
+    });
+
+    // Queries running meanwhile keep reading the current generation, whose
+    // view of the write buffer ends before the new document. The next one
+    // gets a view that includes it; nothing is copied.
+    buffer_->AddDocument(document_id, status, ComputeAverageRating(ratings), move(terms));
+    SegmentVersion& buffer = next->segments.back();
+    buffer.segment = make_shared<const IndexSegment>(ViewWriteBuffer(buffer_));
+    next->term_count = static_cast<int>(terms_.size());
+    next->documents[document_id] = {buffer.serial, buffer_->GetDocumentCount() - 1};
+    ++next->document_count;
+    ++next->epoch;
+
+    const bool sealed = buffer_->GetDocumentCount() >= SEGMENT_BUFFER_SIZE;
+    if (sealed) {
+        // The full buffer is rebuilt into a sealed segment without its
+        // removed documents, which moves the others to new ordinals.
+        vector<int> new_ordinals;
+        buffer.segment = make_shared<const IndexSegment>(MergeSegments({buffer}, new_ordinals));
+        buffer.removed = make_shared<const Tombstones>();
+        next->LocateDocuments(next->segments.size() - 1);
+        next->AddBuffer();
+        buffer_ = make_shared<WriteBuffer>();
+    }
+
+    atomic_store(&snapshot_, shared_ptr<const IndexSnapshot>(move(next)));
+
+    if (sealed) {
+        RequestMerge();
+    }
+}
+
+void SearchServer::AddDocuments(const vector<DocumentInput>& documents) {
+    lock_guard guard(write_mutex_);
+    AddDocumentsLocked(documents);
+}
+
+void SearchServer::AddDocumentsLocked(const vector<DocumentInput>& documents) {
+    const auto current = GetSnapshot();
+
+    set<int> batch_ids;
+    for (const DocumentInput& document : documents) {
+        if (document.id < 0) {
+            throw invalid_argument("attempt to add document with negative id");
+        }
+        if (!batch_ids.insert(document.id).second || FindDocument(*current, document.id)) {
+            throw invalid_argument("attempt to add document twice");
+        }
+    }
+    if (documents.empty()) {
+        return;
+    }
+
+    // A chunk of consecutive documents is tokenized and indexed into a
+    // segment of its own. Words get their local ids in the order they first
+    // occur, so interning chunk by chunk gives the same term ids as adding
+    // the documents one by one.
+    struct Chunk {
+        size_t first_document;
+        size_t last_document;
+        vector<vector<int>> document_words;
+        vector<string_view> local_terms;
+        vector<int> terms;
+        exception_ptr error;
+        shared_ptr<const IndexSegment> segment;
+    };
+
+    const int chunk_count = GetShardCount(static_cast<int>(documents.size()));
+    vector<Chunk> chunks(chunk_count);
+    for (int i = 0; i < chunk_count; ++i) {
+        chunks[i].first_document = documents.size() * i / chunk_count;
+        chunks[i].last_document = documents.size() * (i + 1) / chunk_count;
+    }
 
-    const double inv_count = 1.0 / words.size();
+    for_each(execution::par, chunks.begin(), chunks.end(), [&](Chunk& chunk) {
+        map<string_view, int> local_ids;
+        // Exceptions must not escape a parallel algorithm.
+        try {
+            for (size_t i = chunk.first_document; i < chunk.last_document; ++i) {
+                vector<int>& words = chunk.document_words.emplace_back();
+                for (string_view word : SplitIntoWordsNoStop(documents[i].text)) {
+                    const auto [it, inserted] =
+                        local_ids.emplace(word, static_cast<int>(chunk.local_terms.size()));
+                    if (inserted) {
+                        chunk.local_terms.push_back(word);
+                    }
+                    words.push_back(it->second);
+                }
+            }
+        } catch (...) {
+            chunk.error = current_exception();
+        }
+    });
 
-    for (const string& word : words) {
-        word_to_document_freqs_[word][document_id] += inv_count;
+    for (const Chunk& chunk : chunks) {
+        if (chunk.error) {
+            rethrow_exception(chunk.error);
+        }
     }
 
-    document_ratings_[document_id] = ComputeAverageRating(ratings);
-    document_status_[document_id] = status;
+    for (Chunk& chunk : chunks) {
+        chunk.terms.reserve(chunk.local_terms.size());
+        for (string_view word : chunk.local_terms) {
+            chunk.terms.push_back(terms_.Intern(word));
+        }
+    }
 
-    document_ids_.push_back(document_id);
+    for_each(execution::par, chunks.begin(), chunks.end(), [&](Chunk& chunk) {
+        SegmentBuilder builder;
+        for (size_t i = 0; i < chunk.document_words.size(); ++i) {
+            const DocumentInput& document = documents[chunk.first_document + i];
+
+            vector<int> terms;
+            terms.reserve(chunk.document_words[i].size());
+            for (int local_id : chunk.document_words[i]) {
+                terms.push_back(chunk.terms[local_id]);
+            }
+            builder.AddDocument(document.id, document.status,
+                                ComputeAverageRating(document.ratings), move(terms));
+        }
+        chunk.segment = make_shared<const IndexSegment>(builder.Build());
+    });
+
+    // The documents of the write buffer go first into the batch segment, so
+    // a partial buffer is not sealed as a tiny segment of its own.
+    vector<SegmentVersion> parts;
+    if (current->GetBuffer().GetDocumentCount() > 0) {
+        parts.push_back(current->segments.back());
+    }
+    for (const Chunk& chunk : chunks) {
+        // Merge inputs need no serial.
+        parts.push_back({0, chunk.segment});
+    }
+    SegmentVersion batch = parts[0];
+    if (parts.size() > 1) {
+        vector<int> new_ordinals;
+        batch.segment = make_shared<const IndexSegment>(MergeSegments(parts, new_ordinals));
+        batch.removed = make_shared<const Tombstones>();
+    }
+
+    auto next = make_shared<IndexSnapshot>(*current);
+    batch.serial = next->next_segment_serial++;
+    next->segments.back() = move(batch);
+    next->LocateDocuments(next->segments.size() - 1);
+    next->AddBuffer();
+    next->term_count = static_cast<int>(terms_.size());
+    next->document_count += static_cast<int>(documents.size());
+    ++next->epoch;
+
+    LogChange(*next, [&documents, &next](WriteAheadLog& log) {
+        uint64_t sequence = next->log_sequence;
+        for (const DocumentInput& document : documents) {
+            sequence = log.AppendAdd(document.id, document.text, document.status, document.ratings);
+        }
+        return sequence;
+    });
+
+    buffer_ = make_shared<WriteBuffer>();
+    atomic_store(&snapshot_, shared_ptr<const IndexSnapshot>(move(next)));
+
+    RequestMerge();
 }
 
-vector<Document> SearchServer::FindTopDocuments(const string& raw_query,
-                                                DocumentStatus document_status) const {
-    return FindTopDocuments(
-        raw_query, [document_status](int document_id, DocumentStatus status,
-                                     int rating) {
-            return status == document_status;
-        });
+void SearchServer::RemoveDocument(int document_id) {
+    lock_guard guard(write_mutex_);
+    RemoveDocumentLocked(document_id);
 }
 
-vector<Document> SearchServer::FindTopDocuments(const string& raw_query) const {
-    return FindTopDocuments(
-        raw_query, [](int document_id, DocumentStatus status, int rating) {
-            return status == DocumentStatus::ACTUAL;
-        });
+void SearchServer::RemoveDocumentLocked(int document_id) {
+    const auto current = GetSnapshot();
+
+    const auto location = current->FindDocument(document_id);
+    if (!location) {
+        return;
+    }
+    const auto [i, ordinal] = *location;
+    const SegmentVersion& segment = current->segments[i];
+
+    // Queries on the current generation keep its tombstones; the next one
+    // gets a copy with the document marked.
+    auto removed = make_shared<Tombstones>(*segment.removed);
+    removed->Set(*segment.segment, ordinal);
+
+    auto next = make_shared<IndexSnapshot>(*current);
+    next->segments[i].removed = move(removed);
+    next->documents.Erase(document_id);
+    --next->document_count;
+    ++next->epoch;
+    LogChange(*next, [document_id](WriteAheadLog& log) { return log.AppendRemove(document_id); });
+
+    // The write buffer is purged when it is sealed.
+    const bool sealed = i + 1 < next->segments.size();
+    const bool compact = sealed && NeedsCompaction(next->segments[i]);
+    atomic_store(&snapshot_, shared_ptr<const IndexSnapshot>(move(next)));
+
+    if (compact) {
+        RequestMerge();
+    }
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query,
+                                                DocumentStatus document_status,
+                                                size_t top_k) const {
+    return FindTopDocumentsCached(execution::seq, raw_query, document_status, top_k);
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
-tuple<vector<string>, DocumentStatus> SearchServer::MatchDocument(const string& raw_query,
-                                                                  int document_id) const {
-    Query query = ParseQuery(raw_query);
+SearchServer::QueryStepper SearchServer::StartQuery(string_view raw_query,
+                                                    DocumentStatus document_status, size_t top_k,
+                                                    size_t step_postings) const {
+    auto index = GetSnapshot();
+    Query query = ParseQuery(*index, raw_query);
+    ResultCache::Key key{query.plus_terms, query.minus_terms, document_status, top_k};
+
+    if (auto documents = result_cache_.Find(key, index->epoch)) {
+        QueryStepper stepper(*this, move(index), move(query), move(key));
+        stepper.result_ = move(*documents);
+        stepper.done_ = true;
+        return stepper;
+    }
+
+    // An empty result needs no scoring.
+    if (top_k == 0) {
+        QueryStepper stepper(*this, move(index), move(query), move(key));
+        stepper.Finish();
+        return stepper;
+    }
 
-    for (const string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    ComputeIdfs(*index, query);
+    QueryStepper stepper(*this, index, move(query), move(key));
+    stepper.prune_ = top_k < static_cast<size_t>(index->document_count);
+
+    for (const SegmentVersion& segment : index->segments) {
+        const int document_count = segment.segment->GetDocumentCount();
+        size_t posting_count = 0;
+        for (const auto* terms : {&stepper.query_.plus_terms, &stepper.query_.minus_terms}) {
+            for (int term_id : *terms) {
+                posting_count += segment.segment->GetDocumentFreq(term_id);
+            }
+        }
+        if (document_count == 0 || posting_count == 0) {
             continue;
         }
-        if (word_to_document_freqs_.at(word).count(document_id) > 0) {
-            return {
-                tuple(vector<string>(), document_status_.at(document_id))};
+
+        // Postings are assumed to spread evenly over the ordinals.
+        const int range_count = step_postings == 0 || posting_count <= step_postings
+                                    ? 1
+                                    : static_cast<int>(min<size_t>(
+                                          document_count,
+                                          (posting_count + step_postings - 1) / step_postings));
+        for (int range = 0; range < range_count; ++range) {
+            stepper.ranges_.push_back(
+                {&segment, static_cast<int>(int64_t{document_count} * range / range_count),
+                 static_cast<int>(int64_t{document_count} * (range + 1) / range_count)});
+        }
+    }
+
+    if (stepper.ranges_.empty()) {
+        stepper.Finish();
+    }
+    return stepper;
+}
+
+SearchServer::QueryStepper::QueryStepper(const SearchServer& server,
+                                         shared_ptr<const IndexSnapshot> index, Query query,
+                                         ResultCache::Key key)
+    : server_(&server),
+      index_(move(index)),
+      query_(move(query)),
+      key_(move(key)),
+      selector_(min(key_.top_k, static_cast<size_t>(index_->document_count)), RankedHigher{}) {}
+
+bool SearchServer::QueryStepper::Step() {
+    if (done_) {
+        return true;
+    }
+
+    const Range& range = ranges_[next_range_++];
+    const auto predicate = [document_status = key_.status](int document_id,
+                                                           DocumentStatus status, int rating) {
+        return status == document_status;
+    };
+
+    const bool whole_segment = range.first_ordinal == 0 &&
+                               range.last_ordinal == range.segment->segment->GetDocumentCount();
+    if (prune_ && whole_segment) {
+        server_->FindTopDocumentsWithPruning(*range.segment, query_, predicate, selector_);
+    } else {
+        for (Document& document : server_->FindAllDocuments(*range.segment, query_, predicate,
+                                                            range.first_ordinal,
+                                                            range.last_ordinal)) {
+            selector_.Push(document);
+        }
+    }
+
+    if (next_range_ == ranges_.size()) {
+        Finish();
+    }
+    return done_;
+}
+
+void SearchServer::QueryStepper::Finish() {
+    result_ = selector_.Extract();
+    server_->result_cache_.Insert(key_, index_->epoch, result_);
+    done_ = true;
+}
+
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_view raw_query,
+                                                                       int document_id) const {
+    const auto index = GetSnapshot();
+
+    const auto location = FindDocument(*index, document_id);
+    if (!location) {
+        throw out_of_range("document not found");
+    }
+    const auto [segment, ordinal] = *location;
+
+    Query query = ParseQuery(*index, raw_query);
+
+    for (int term_id : query.minus_terms) {
+        if (segment->ContainsTerm(ordinal, term_id)) {
+            return {tuple(vector<string_view>(), segment->document_status[ordinal])};
+        }
+    }
+
+    vector<string_view> words;
+
+    for (int term_id : query.plus_terms) {
+        if (segment->ContainsTerm(ordinal, term_id)) {
+            words.push_back(terms_.GetTerm(term_id));
+        }
+    }
+
+    sort(words.begin(), words.end());
+
+    return {tuple(words, segment->document_status[ordinal])};
+}
+
+const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
+    static const map<string_view, double> empty_frequencies;
+
+    const auto index = GetSnapshot();
+    const auto location = FindDocument(*index, document_id);
+    if (!location) {
+        return empty_frequencies;
+    }
+    const auto [segment, ordinal] = *location;
+    return segment->word_frequencies[ordinal]->Get(*segment, ordinal, terms_);
+}
+
+int SearchServer::GetDocumentCount() const { return GetSnapshot()->document_count; }
+
+int SearchServer::GetSegmentCount() const {
+    return static_cast<int>(GetSnapshot()->segments.size());
+}
+
+ResultCache::Stats SearchServer::GetResultCacheStats() const { return result_cache_.GetStats(); }
+
+int SearchServer::GetDocumentId(int index) const {
+    if (index >= 0) {
+        for (const SegmentVersion& segment : GetSnapshot()->segments) {
+            const int live_count = segment.GetLiveDocumentCount();
+            if (index < live_count) {
+                return segment.segment->document_ids[segment.removed->FindLiveOrdinal(index)];
+            }
+            index -= live_count;
         }
     }
+    throw out_of_range("document index is out of range");
+}
+
+void SearchServer::SaveIndex(const string& path) const {
+    const auto index = GetSnapshot();
+
+    vector<int> new_ordinals;
+    const IndexSegment segment = MergeSegments(index->segments, new_ordinals);
+
+    vector<string_view> terms;
+    terms.reserve(index->term_count);
+    for (int term_id = 0; term_id < index->term_count; ++term_id) {
+        terms.push_back(terms_.GetTerm(term_id));
+    }
+
+    WriteIndexFile(path, index->log_sequence,
+                   vector<string_view>(stop_words_.begin(), stop_words_.end()), terms, segment);
+
+    // The log records the file includes are not needed any more.
+    lock_guard guard(write_mutex_);
+    if (log_) {
+        log_->Truncate(index->log_sequence);
+    }
+}
+
+void SearchServer::OpenLog(const string& path, WriteAheadLogOptions options) {
+    // Held through the replay, so no change slips in unlogged.
+    lock_guard guard(write_mutex_);
+    if (log_) {
+        throw logic_error("write-ahead log is already open");
+    }
 
-    vector<string> words;
+    // Records are replayed through the batch path; removals split batches
+    // to keep the order of changes.
+    const auto records = WriteAheadLog::ReadRecords(path);
+    const uint64_t applied_sequence = GetSnapshot()->log_sequence;
 
-    for (const string& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    vector<DocumentInput> batch;
+    for (const auto& record : records) {
+        if (record.sequence <= applied_sequence) {
             continue;
         }
-        if (word_to_document_freqs_.at(word).count(document_id) > 0) {
-            words.push_back(word);
+        if (record.type == WriteAheadLog::RecordType::ADD) {
+            batch.push_back({record.document_id, record.text, record.status, record.ratings});
+            continue;
         }
+        AddDocumentsLocked(batch);
+        batch.clear();
+        RemoveDocumentLocked(record.document_id);
+    }
+    AddDocumentsLocked(batch);
+
+    auto next = make_shared<IndexSnapshot>(*GetSnapshot());
+    if (!records.empty()) {
+        next->log_sequence = max(next->log_sequence, records.back().sequence);
+    }
+    log_ = make_unique<WriteAheadLog>(path, options, next->log_sequence);
+    atomic_store(&snapshot_, shared_ptr<const IndexSnapshot>(move(next)));
+}
+
+void SearchServer::SyncLog() {
+    lock_guard guard(write_mutex_);
+    if (log_) {
+        log_->Sync();
     }
+}
+
+void SearchServer::WaitForMerges() {
+    unique_lock lock(merge_mutex_);
+    merge_condition_.wait(lock, [this] { return !merge_requested_ && !merging_; });
+    if (merge_error_) {
+        rethrow_exception(merge_error_);
+    }
+}
+
+shared_ptr<const IndexSnapshot> SearchServer::GetSnapshot() const {
+    return atomic_load(&snapshot_);
+}
 
-    return {tuple(words, document_status_.at(document_id))};
+optional<pair<const IndexSegment*, int>> SearchServer::FindDocument(const IndexSnapshot& index,
+                                                                     int document_id) {
+    const auto location = index.FindDocument(document_id);
+    if (!location) {
+        return nullopt;
+    }
+    return pair{index.segments[location->first].segment.get(), location->second};
 }
 
-int SearchServer::GetDocumentCount() const { return document_status_.size(); }
+void SearchServer::RequestMerge() {
+    {
+        lock_guard guard(merge_mutex_);
+        if (merge_error_) {
+            return;
+        }
+        merge_requested_ = true;
+        if (!merger_.joinable()) {
+            merger_ = thread([this] { RunMerger(); });
+        }
+    }
+    merge_condition_.notify_all();
+}
 
-int SearchServer::GetDocumentId(int index) const { return document_ids_.at(index); }
+void SearchServer::RunMerger() {
+    unique_lock lock(merge_mutex_);
+    while (true) {
+        merge_condition_.wait(lock, [this] { return stopping_ || merge_requested_; });
+        if (stopping_) {
+            return;
+        }
+        merge_requested_ = false;
+        merging_ = true;
+
+        lock.unlock();
+        exception_ptr error;
+        // The segments stay as they are; WaitForMerges reports the error.
+        try {
+            while (MergeSegmentsOnce()) {
+            }
+        } catch (...) {
+            error = current_exception();
+        }
+        lock.lock();
+
+        merging_ = false;
+        if (error) {
+            merge_error_ = error;
+            merge_requested_ = false;
+            merge_condition_.notify_all();
+            return;
+        }
+        merge_condition_.notify_all();
+    }
+}
 
-bool SearchServer::IsValidWord(const string& word) {
+bool SearchServer::MergeSegmentsOnce() {
+    vector<SegmentVersion> inputs;
+    {
+        lock_guard guard(write_mutex_);
+        inputs = SelectSegmentsToMerge(*GetSnapshot());
+    }
+    if (inputs.empty()) {
+        return false;
+    }
+
+    // The expensive part runs without blocking AddDocument.
+    vector<int> new_ordinals;
+    SegmentVersion merged;
+    merged.segment = make_shared<const IndexSegment>(MergeSegments(inputs, new_ordinals));
+
+    lock_guard guard(write_mutex_);
+    auto next = make_shared<IndexSnapshot>(*GetSnapshot());
+
+    // Only the merger removes sealed segments, so the inputs are still
+    // there, consecutive and in the same order.
+    auto& segments = next->segments;
+    const auto find_input = [&segments](const SegmentVersion& input) {
+        return find_if(segments.begin(), segments.end(), [&input](const SegmentVersion& segment) {
+            return segment.segment == input.segment;
+        });
+    };
+    const auto first_input = find_input(inputs.front());
+
+    // Documents removed while the merge ran are still in the merged segment.
+    auto removed = make_shared<Tombstones>();
+    size_t position = 0;
+    for (auto current = first_input; current != first_input + inputs.size(); ++current) {
+        for (int ordinal = 0; ordinal < current->segment->GetDocumentCount();
+             ++ordinal, ++position) {
+            if (new_ordinals[position] >= 0 && current->IsRemoved(ordinal)) {
+                removed->Set(*merged.segment, new_ordinals[position]);
+            }
+        }
+    }
+    merged.removed = move(removed);
+    merged.serial = next->next_segment_serial++;
+
+    auto first = segments.erase(first_input, first_input + inputs.size());
+    if (merged.segment->GetDocumentCount() > 0) {
+        next->LocateDocuments(segments.insert(first, move(merged)) - segments.begin());
+    }
+
+    atomic_store(&snapshot_, shared_ptr<const IndexSnapshot>(move(next)));
+    return true;
+}
+
+vector<SegmentVersion> SearchServer::SelectSegmentsToMerge(
+    const IndexSnapshot& index) {
+    // Segments of SEGMENT_BUFFER_SIZE * SEGMENT_MERGE_FACTOR^t documents and
+    // up to the next power are in tier t. Merging runs of the newest tier
+    // keeps the segment count logarithmic in the document count.
+    const auto get_tier = [](int document_count) {
+        int tier = 0;
+        for (int64_t size = int64_t{SEGMENT_BUFFER_SIZE} * SEGMENT_MERGE_FACTOR;
+             size <= document_count; size *= SEGMENT_MERGE_FACTOR) {
+            ++tier;
+        }
+        return tier;
+    };
+
+    // The last segment is the write buffer.
+    const auto sealed_end = index.segments.end() - 1;
+
+    // AddDocuments may put a large segment after smaller ones, so older runs
+    // are looked at as well.
+    for (auto last = sealed_end; last - index.segments.begin() >= SEGMENT_MERGE_FACTOR; --last) {
+        const auto first = last - SEGMENT_MERGE_FACTOR;
+        const int tier = get_tier(first->segment->GetDocumentCount());
+        if (all_of(first, last, [&](const SegmentVersion& segment) {
+                return get_tier(segment.segment->GetDocumentCount()) == tier;
+            })) {
+            return {first, last};
+        }
+    }
+
+    // Batches of different sizes can interleave tiers so that no run is
+    // uniform. Smaller segments sandwiched between segments of a tier are
+    // then merged into the older one, as a run starting with the largest
+    // segment and followed by one at least as large. Small segments at the
+    // end are left for the run above, so the newest documents do not make
+    // large segments be rewritten again and again.
+    for (auto last = sealed_end - 1; last - index.segments.begin() >= SEGMENT_MERGE_FACTOR; --last) {
+        const auto first = last - SEGMENT_MERGE_FACTOR;
+        const int tier = get_tier(first->segment->GetDocumentCount());
+        const auto in_tier_or_above = [&](const SegmentVersion& segment) {
+            return get_tier(segment.segment->GetDocumentCount()) >= tier;
+        };
+        if (all_of(first + 1, last, [&](const SegmentVersion& segment) {
+                return get_tier(segment.segment->GetDocumentCount()) <= tier;
+            }) &&
+            any_of(last, sealed_end, in_tier_or_above)) {
+            return {first, last};
+        }
+    }
+
+    const auto compacted = find_if(index.segments.begin(), sealed_end,
+                                   [](const auto& segment) { return NeedsCompaction(segment); });
+    if (compacted != sealed_end) {
+        return {*compacted};
+    }
+    return {};
+}
+
+bool SearchServer::NeedsCompaction(const SegmentVersion& segment) {
+    const int removed_count = segment.removed->GetCount();
+    return removed_count > 0 &&
+           removed_count * SEGMENT_COMPACTION_RATIO >= segment.segment->GetDocumentCount();
+}
+
+int SearchServer::GetShardCount(int document_count) {
+    // Below this size a shard is not worth a task of its own
+    const int min_shard_size = 1024;
+    const int max_shard_count = 4 * static_cast<int>(max(1u, thread::hardware_concurrency()));
+
+    return clamp(document_count / min_shard_size, 1, max_shard_count);
+}
+
+bool SearchServer::IsValidWord(string_view word) {
     return none_of(word.begin(), word.end(),
                    [](char c) { return c >= '\0' && c < ' '; });  // [0, 32)
 }
@@ -104,17 +745,11 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return total / static_cast<int>(ratings.size());
 }
 
-double SearchServer::CalculateIDF(const string& word) const {
-    return log(
-        GetDocumentCount() /
-        static_cast<double>(word_to_document_freqs_.at(word).size()));
-}
-
-SearchServer::QueryWord SearchServer::ParseQueryWord(string text) const {
+SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
     bool is_minus = false;
     if (text[0] == '-') {
         is_minus = true;
-        text = text.substr(1);
+        text.remove_prefix(1);
     }
 
     if (!SearchServer::IsValidWord(text)) {
@@ -128,34 +763,47 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string text) const {
     return {text, is_minus};
 }
 
-SearchServer::Query SearchServer::ParseQuery(const string& text) const {
+SearchServer::Query SearchServer::ParseQuery(const IndexSnapshot& index, string_view text) const {
     Query query;
-    for (string word : SplitIntoWordsNoStop(text)) {
+    for (string_view word : SplitIntoWordsNoStop(text)) {
         QueryWord query_word = ParseQueryWord(word);
 
+        const auto term_id = terms_.Find(query_word.data);
+        if (!term_id || *term_id >= index.term_count) {
+            continue;
+        }
+
         if (query_word.is_minus) {
-            query.minus_words.insert(query_word.data);
+            query.minus_terms.push_back(*term_id);
         } else {
-            query.plus_words.insert(query_word.data);
+            query.plus_terms.push_back(*term_id);
         }
     }
+
+    for (auto* terms : {&query.plus_terms, &query.minus_terms}) {
+        sort(terms->begin(), terms->end());
+        terms->erase(unique(terms->begin(), terms->end()), terms->end());
+    }
+
     return query;
 }
 
-bool SearchServer::IsStopWord(const string& word) const {
-    return stop_words_.count(word) > 0;
+void SearchServer::ComputeIdfs(const IndexSnapshot& index, Query& query) const {
+    query.plus_idfs.clear();
+    for (int term_id : query.plus_terms) {
+        query.plus_idfs.push_back(
+            idf_cache_.Get(term_id, index.epoch, [&index, term_id] { return index.GetIdf(term_id); }));
+    }
 }
 
-vector<string> SearchServer::SplitIntoWordsNoStop(const string& text) const {
-    vector<string> words;
-    for (const string& word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw invalid_argument("word is invalid: " + word);
-        }
+bool SearchServer::IsStopWord(string_view word) const {
+    return stop_words_.count(word) > 0;
+}
 
-        if (!IsStopWord(word)) {
-            words.push_back(word);
-        }
-    }
+vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
+    vector<string_view> words = SplitIntoValidWords(text);
+    words.erase(remove_if(words.begin(), words.end(),
+                          [this](string_view word) { return IsStopWord(word); }),
+                words.end());
     return words;
 }
\ No newline at end of file
@@ -1,18 +1,51 @@
 #pragma once
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <execution>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "document.h"
+#include "idf_cache.h"
+#include "index_file.h"
+#include "index_segment.h"
+#include "index_snapshot.h"
+#include "posting_list.h"
+#include "result_cache.h"
+#include "score_accumulator.h"
+#include "term_dictionary.h"
+#include "top_k_selector.h"
+#include "write_ahead_log.h"
+#include "write_buffer.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double EPSILON = 1e-6;
 
+// A document for SearchServer::AddDocuments. The text is only read during
+// the call.
+struct DocumentInput {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
 class SearchServer {
    public:
     template <typename StringContainer>
@@ -20,128 +53,737 @@ class SearchServer {
 
     explicit SearchServer(const std::string& stop_words_text);
 
-    void AddDocument(int document_id, const std::string& document,
-                     DocumentStatus status, const std::vector<int>& ratings);
-
-    template <typename Predicate>
-    std::vector<Document> FindTopDocuments(const std::string& raw_query,
-                                           Predicate predicate) const;
+    ~SearchServer();
 
-    std::vector<Document> FindTopDocuments(const std::string& raw_query,
-                                           DocumentStatus document_status) const;
+    void AddDocument(int document_id, std::string_view document,
+                     DocumentStatus status, const std::vector<int>& ratings);
 
-    std::vector<Document> FindTopDocuments(const std::string& raw_query) const;
+    // Adds all documents or, if any of them is invalid, none. Tokenizing and
+    // indexing run in parallel, and the batch is published as one segment
+    // together with the documents of the write buffer, so the result is the
+    // same as adding the documents one by one.
+    void AddDocuments(const std::vector<DocumentInput>& documents);
+
+    // Marks the document removed; it is skipped by queries at once and purged
+    // from the postings by the background merger. The mark is published in a
+    // copy of the tombstones of the document's segment that shares all but
+    // the changed trie nodes, so removal takes O(document length * log(term
+    // count)) whatever the segment size. Unknown ids are ignored.
+    void RemoveDocument(int document_id);
+
+    // Removal is too little work to split, so every policy does the same as
+    // RemoveDocument(document_id).
+    template <typename ExecutionPolicy,
+              typename = std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>>
+    void RemoveDocument(ExecutionPolicy&& policy, int document_id);
 
-    std::tuple<std::vector<std::string>, DocumentStatus> MatchDocument(const std::string& raw_query,
-                                                                       int document_id) const;
+    template <typename Predicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                           Predicate predicate,
+                                           size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Results of status queries, with or without a policy, are cached until
+    // the index changes; see ResultCache.
+    std::vector<Document> FindTopDocuments(std::string_view raw_query,
+                                           DocumentStatus document_status,
+                                           size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+
+    class QueryStepper;
+
+    // Starts a status query that is evaluated in steps; see QueryStepper.
+    // Invalid queries throw here, as in FindTopDocuments.
+    QueryStepper StartQuery(std::string_view raw_query, DocumentStatus document_status,
+                            size_t top_k, size_t step_postings) const;
+
+    // With a parallel policy the corpus is split into ordinal ranges that
+    // are scored concurrently, so the predicate must be safe to call from
+    // several threads. If it throws, the exception is rethrown once every
+    // range is done. The sequenced policy is the same as no policy.
+    template <typename ExecutionPolicy, typename Predicate,
+              typename = std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy,
+                                           std::string_view raw_query,
+                                           Predicate predicate,
+                                           size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <typename ExecutionPolicy,
+              typename = std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy,
+                                           std::string_view raw_query,
+                                           DocumentStatus document_status,
+                                           size_t top_k = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <typename ExecutionPolicy,
+              typename = std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy,
+                                           std::string_view raw_query) const;
+
+    // The words are views into the term dictionary. Minus words are checked
+    // first, and a matching one ends the check with no words.
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+                                                                            int document_id) const;
+
+    // A parallel policy checks the query words concurrently, which pays off
+    // for long queries only. The sequenced policy is the same as no policy.
+    template <typename ExecutionPolicy,
+              typename = std::enable_if_t<std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>>>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        ExecutionPolicy&& policy, std::string_view raw_query, int document_id) const;
+
+    // Term frequencies of the words of a live document, or an empty map for
+    // an unknown id. The reference stays valid until the document is removed
+    // and purged.
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
     int GetDocumentCount() const;
 
+    ResultCache::Stats GetResultCacheStats() const;
+
+    // Id of the live document at the given position in insertion order, in
+    // O(segment count + log(document count)).
     int GetDocumentId(int index) const;
 
+    // Blocks until the background merger has nothing left to merge. Throws
+    // the error that stopped the merger, such as a corrupted posting list of
+    // an opened index file; no merges run after one.
+    void WaitForMerges();
+
+    // Sealed segments plus the write buffer; the merge policy keeps it
+    // logarithmic in the document count.
+    int GetSegmentCount() const;
+
+    // Writes the live documents, the term dictionary and the stop words to a
+    // file in the format described in index_file.h. The records of an open
+    // log that the file includes are dropped from the log afterwards.
+    void SaveIndex(const std::string& path) const;
+
+    // Opens a file written by SaveIndex. The posting lists, the document
+    // columns, the forward index and the terms are read in place from the
+    // mapped file; only the dictionary's hash table and the document
+    // locations are built, in O(document count + term count). Opening reads
+    // the file once to verify its checksum and structure; a posting list is
+    // decoded and checked when it is first read, and word frequencies of a
+    // document are built on its first GetWordFrequencies call. A file that
+    // fails the checks throws std::runtime_error, at opening or when the
+    // corrupted list is read.
+    static SearchServer OpenIndex(const std::string& path);
+
+    // Replays the records of the log that are newer than the index, usually
+    // one opened with OpenIndex, and then records every added and removed
+    // document in the log before it becomes visible.
+    //
+    // A change is durable when the call making it returns only with the
+    // default options, which write and sync every record at once. With
+    // group_size or groups_per_sync above 1 a change is visible and the
+    // call returns before the change is durable: a crash loses the changes
+    // of at most the last options.max_delay, or of the last unfilled group
+    // if max_delay is 0. groups_per_sync 0 leaves syncing to the OS. SyncLog
+    // makes every change made so far durable.
+    void OpenLog(const std::string& path, WriteAheadLogOptions options = {});
+
+    // Makes every logged change durable regardless of the log options.
+    void SyncLog();
+
    private:
+    // Documents collected in the write buffer before it is sealed.
+    static constexpr int SEGMENT_BUFFER_SIZE = 256;
+    // Number of sealed segments of one size tier that are merged together.
+    static constexpr int SEGMENT_MERGE_FACTOR = 4;
+    // A sealed segment is rewritten on its own once 1/SEGMENT_COMPACTION_RATIO
+    // of its documents are removed.
+    static constexpr int SEGMENT_COMPACTION_RATIO = 5;
+    // Results kept by the result cache and the number of its shards.
+    static constexpr size_t RESULT_CACHE_CAPACITY = 4096;
+    static constexpr size_t RESULT_CACHE_SHARD_COUNT = 16;
+
     struct QueryWord {
-        std::string data;
+        std::string_view data;
         bool is_minus;
     };
 
+    // Orders documents by relevance, then by rating, then by id, so that
+    // the result does not depend on the order documents were collected in.
+    struct RankedHigher {
+        bool operator()(const Document& lhs, const Document& rhs) const {
+            if (std::abs(lhs.relevance - rhs.relevance) >= EPSILON) {
+                return lhs.relevance > rhs.relevance;
+            }
+            if (lhs.rating != rhs.rating) {
+                return lhs.rating > rhs.rating;
+            }
+            return lhs.id < rhs.id;
+        }
+    };
+
+    using DocumentSelector = TopKSelector<Document, RankedHigher>;
+
+    // Term ids of the query words known to the dictionary, sorted and
+    // deduplicated. Words that never occurred in a document are dropped.
     struct Query {
-        std::set<std::string> plus_words;
-        std::set<std::string> minus_words;
+        std::vector<int> plus_terms;
+        std::vector<int> minus_terms;
+        // IDF of every plus term over the whole index, filled by ComputeIdfs.
+        std::vector<double> plus_idfs;
     };
 
-    static bool IsValidWord(const std::string& word);
+    // Tells the constructor below from the one taking stop words.
+    struct FromIndexFile {};
+
+    SearchServer(FromIndexFile, const IndexFileContents& contents);
+
+    // AddDocuments and RemoveDocument with write_mutex_ held.
+    void AddDocumentsLocked(const std::vector<DocumentInput>& documents);
+
+    void RemoveDocumentLocked(int document_id);
+
+    static bool IsValidWord(std::string_view word);
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, int> document_ratings_;
-    std::map<int, DocumentStatus> document_status_;
+    std::set<std::string, std::less<>> stop_words_;
+
+    // Shared by all generations: ids of words are never reassigned.
+    TermDictionary terms_;
+
+    // The current generation. Queries take it with std::atomic_load and work
+    // on it without locks; AddDocument and the merger build the next
+    // generation from a copy and publish it with std::atomic_store. Writers
+    // are serialized. AddDocument appends to the write buffer in place and
+    // publishes a new view of it, so the copy costs O(segment count) besides
+    // the new postings, independent of how full the buffer is.
+    std::shared_ptr<const IndexSnapshot> snapshot_ = std::make_shared<const IndexSnapshot>();
+    mutable std::mutex write_mutex_;
+
+    // The documents of the last segment of the current generation, which
+    // views it. Guarded by write_mutex_.
+    std::shared_ptr<WriteBuffer> buffer_ = std::make_shared<WriteBuffer>();
+
+    // Guarded by write_mutex_.
+    std::unique_ptr<WriteAheadLog> log_;
+
+    mutable ResultCache result_cache_{RESULT_CACHE_CAPACITY, RESULT_CACHE_SHARD_COUNT};
+
+    mutable IdfCache idf_cache_;
+
+    // The merger thread is started by the first sealed buffer.
+    std::mutex merge_mutex_;
+    std::condition_variable merge_condition_;
+    bool merge_requested_ = false;
+    bool merging_ = false;
+    bool stopping_ = false;
+    std::exception_ptr merge_error_;
+    std::thread merger_;
+
+    std::shared_ptr<const IndexSnapshot> GetSnapshot() const;
 
-    std::set<std::string> stop_words_;
+    // Appends the records of a change to the log, if there is one, and sets
+    // the log sequence of the next generation. If appending throws, the
+    // records of the change that were written are cut off again.
+    template <typename AppendRecords>
+    void LogChange(IndexSnapshot& next, AppendRecords append_records);
 
-    std::vector<int> document_ids_;
+    // The segment holding the live document and its ordinal there, found
+    // through the document locations of the generation.
+    static std::optional<std::pair<const IndexSegment*, int>> FindDocument(
+        const IndexSnapshot& index, int document_id);
 
-    double CalculateIDF(const std::string& word) const;
+    void RequestMerge();
 
-    QueryWord ParseQueryWord(std::string text) const;
+    void RunMerger();
 
-    Query ParseQuery(const std::string& text) const;
+    // Merges one run of sealed segments; returns false if there is none.
+    bool MergeSegmentsOnce();
 
-    bool IsStopWord(const std::string& word) const;
+    // The newest SEGMENT_MERGE_FACTOR sealed segments if they are of the
+    // same size tier, otherwise a sealed segment that needs compaction, if
+    // there is one.
+    static std::vector<SegmentVersion> SelectSegmentsToMerge(const IndexSnapshot& index);
 
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string& text) const;
+    static bool NeedsCompaction(const SegmentVersion& segment);
 
+    QueryWord ParseQueryWord(std::string_view text) const;
+
+    // Terms interned after the snapshot was published are dropped as well.
+    Query ParseQuery(const IndexSnapshot& index, std::string_view text) const;
+
+    // Only scoring needs IDFs, so matching does not pay for them.
+    // A term is summed over the segments once per epoch; later queries
+    // take its IDF from the cache.
+    void ComputeIdfs(const IndexSnapshot& index, Query& query) const;
+
+    bool IsStopWord(std::string_view word) const;
+
+    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+
+    // Term-at-a-time evaluation that scores every posting of the query
+    // belonging to a document with an ordinal in [first_ordinal, last_ordinal).
     template <typename Predicate>
-    std::vector<Document> FindAllDocuments(const Query& query,
-                                           Predicate predicate) const;
+    std::vector<Document> FindAllDocuments(const SegmentVersion& version, const Query& query,
+                                           Predicate predicate, int first_ordinal,
+                                           int last_ordinal) const;
+
+    // Number of ordinal ranges a parallel query is split into.
+    static int GetShardCount(int document_count);
+
+    // Document-at-a-time Block-Max WAND evaluation of one segment. Skips
+    // postings whose block-max upper bound cannot get into the selector; the
+    // result is the same as pushing everything FindAllDocuments finds.
+    template <typename Predicate>
+    void FindTopDocumentsWithPruning(const SegmentVersion& version, const Query& query,
+                                     Predicate predicate, DocumentSelector& selector) const;
+
+    // Evaluate a parsed query with IDFs against one snapshot, segment by
+    // segment or in parallel over ordinal ranges of all segments.
+    template <typename Predicate>
+    std::vector<Document> SelectTopDocuments(const IndexSnapshot& index, const Query& query,
+                                             Predicate predicate, size_t top_k) const;
+
+    template <typename Predicate>
+    std::vector<Document> SelectTopDocumentsParallel(const IndexSnapshot& index,
+                                                     const Query& query, Predicate predicate,
+                                                     size_t top_k) const;
+
+    // Status queries look up the normalized query in the result cache before
+    // they are scored.
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsCached(ExecutionPolicy&& policy,
+                                                 std::string_view raw_query,
+                                                 DocumentStatus document_status,
+                                                 size_t top_k) const;
+};
+
+// A status query evaluated in steps, so that a scheduler can interleave long
+// queries with short ones and check deadlines between the steps. A step
+// scores one segment or, for a segment holding more than step_postings
+// postings of the query, an ordinal range of it with about that many. The
+// result is the same as that of FindTopDocuments and goes to the result
+// cache. The snapshot is held until the stepper is destroyed.
+class SearchServer::QueryStepper {
+   public:
+    // Runs the next step and returns true once the query is complete.
+    bool Step();
+
+    bool IsDone() const { return done_; }
+
+    // Only valid once the query is complete.
+    std::vector<Document> GetResult() { return std::move(result_); }
+
+   private:
+    friend class SearchServer;
+
+    struct Range {
+        const SegmentVersion* segment;
+        int first_ordinal;
+        int last_ordinal;
+    };
+
+    const SearchServer* server_;
+    std::shared_ptr<const IndexSnapshot> index_;
+    Query query_;
+    ResultCache::Key key_;
+    DocumentSelector selector_;
+    // Set if the query can skip postings: whole segments are then evaluated
+    // with pruning, as FindTopDocuments does.
+    bool prune_ = false;
+    std::vector<Range> ranges_;
+    size_t next_range_ = 0;
+    bool done_ = false;
+    std::vector<Document> result_;
+
+    QueryStepper(const SearchServer& server, std::shared_ptr<const IndexSnapshot> index,
+                 Query query, ResultCache::Key key);
+
+    void Finish();
 };
 
 template <typename StringContainer>
 SearchServer::SearchServer(const StringContainer& stop_words) {
-    for (const std::string& word : stop_words) {
+    for (const auto& word : stop_words) {
         if (!IsValidWord(word)) {
-            throw std::invalid_argument("stop word is invalid: " + word);
+            throw std::invalid_argument("stop word is invalid: " + std::string(word));
         }
-        stop_words_.insert(word);
+        stop_words_.emplace(word);
     }
 }
 
+template <typename ExecutionPolicy, typename>
+void SearchServer::RemoveDocument(ExecutionPolicy&&, int document_id) {
+    RemoveDocument(document_id);
+}
+
 template <typename Predicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string& raw_query,
-                                                     Predicate predicate) const {
-    Query query = ParseQuery(raw_query);
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
+                                                     Predicate predicate,
+                                                     size_t top_k) const {
+    const auto index = GetSnapshot();
+    Query query = ParseQuery(*index, raw_query);
+    ComputeIdfs(*index, query);
+    return SelectTopDocuments(*index, query, predicate, top_k);
+}
+
+template <typename ExecutionPolicy, typename Predicate, typename>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+                                                     std::string_view raw_query,
+                                                     Predicate predicate,
+                                                     size_t top_k) const {
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+        return FindTopDocuments(raw_query, predicate, top_k);
+    } else {
+        const auto index = GetSnapshot();
+        Query query = ParseQuery(*index, raw_query);
+        ComputeIdfs(*index, query);
+        return SelectTopDocumentsParallel(*index, query, predicate, top_k);
+    }
+}
 
-    auto matched_documents = FindAllDocuments(query, predicate);
+template <typename ExecutionPolicy, typename>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+                                                     std::string_view raw_query,
+                                                     DocumentStatus document_status,
+                                                     size_t top_k) const {
+    return FindTopDocumentsCached(policy, raw_query, document_status, top_k);
+}
 
-    std::sort(matched_documents.begin(), matched_documents.end(),
-              [](const Document& lhs, const Document& rhs) {
-                  return std::abs(lhs.relevance - rhs.relevance) < EPSILON
-                             ? lhs.rating > rhs.rating
-                             : lhs.relevance > rhs.relevance;
-              });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename ExecutionPolicy, typename>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+                                                     std::string_view raw_query) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::SelectTopDocuments(const IndexSnapshot& index,
+                                                       const Query& query, Predicate predicate,
+                                                       size_t top_k) const {
+    // Selectors reserve top_k entries, and no more than the live documents
+    // can match.
+    top_k = std::min(top_k, static_cast<size_t>(index.document_count));
+    if (top_k == 0) {
+        return {};
     }
+    // When every match fits into the result there is nothing to prune.
+    const bool prune = top_k < static_cast<size_t>(index.document_count);
 
-    return matched_documents;
+    DocumentSelector selector(top_k, RankedHigher{});
+    for (const SegmentVersion& segment : index.segments) {
+        if (prune) {
+            FindTopDocumentsWithPruning(segment, query, predicate, selector);
+            continue;
+        }
+        for (Document& document : FindAllDocuments(segment, query, predicate, 0,
+                                                   segment.segment->GetDocumentCount())) {
+            selector.Push(document);
+        }
+    }
+
+    return selector.Extract();
 }
 
 template <typename Predicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
-                                                     Predicate predicate) const {
-    std::map<int, double> document_to_relevance;
+std::vector<Document> SearchServer::SelectTopDocumentsParallel(const IndexSnapshot& index,
+                                                               const Query& query,
+                                                               Predicate predicate,
+                                                               size_t top_k) const {
+    top_k = std::min(top_k, static_cast<size_t>(index.document_count));
+    if (top_k == 0) {
+        return {};
+    }
+
+    struct Shard {
+        const SegmentVersion* segment;
+        int first_ordinal;
+        int last_ordinal;
+    };
 
-    for (const std::string& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    std::vector<Shard> shards;
+    for (const SegmentVersion& segment : index.segments) {
+        const int document_count = segment.segment->GetDocumentCount();
+        if (document_count == 0) {
             continue;
         }
-        for (const auto& [id, tf] : word_to_document_freqs_.at(word)) {
-            auto rating = document_ratings_.at(id);
-            auto status = document_status_.at(id);
+        const int shard_count = GetShardCount(document_count);
+        for (int shard = 0; shard < shard_count; ++shard) {
+            shards.push_back(
+                {&segment,
+                 static_cast<int>(int64_t{document_count} * shard / shard_count),
+                 static_cast<int>(int64_t{document_count} * (shard + 1) / shard_count)});
+        }
+    }
 
-            if (predicate(id, status, rating)) {
-                document_to_relevance[id] += tf * CalculateIDF(word);
+    std::vector<std::vector<Document>> shard_results(shards.size());
+    std::vector<std::exception_ptr> shard_errors(shards.size());
+
+    std::for_each(std::execution::par, shards.begin(), shards.end(), [&](const Shard& shard) {
+        const size_t i = &shard - shards.data();
+        // Exceptions of the predicate must not escape a parallel algorithm.
+        try {
+            const size_t shard_size = static_cast<size_t>(shard.last_ordinal - shard.first_ordinal);
+            DocumentSelector selector(std::min(top_k, shard_size), RankedHigher{});
+            for (Document& document : FindAllDocuments(*shard.segment, query, predicate,
+                                                       shard.first_ordinal, shard.last_ordinal)) {
+                selector.Push(document);
             }
+            shard_results[i] = selector.Extract();
+        } catch (...) {
+            shard_errors[i] = std::current_exception();
+        }
+    });
+
+    for (const std::exception_ptr& error : shard_errors) {
+        if (error) {
+            std::rethrow_exception(error);
         }
     }
 
-    for (const std::string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    DocumentSelector selector(top_k, RankedHigher{});
+    for (std::vector<Document>& documents : shard_results) {
+        for (Document& document : documents) {
+            selector.Push(document);
+        }
+    }
+
+    return selector.Extract();
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsCached(ExecutionPolicy&& policy,
+                                                           std::string_view raw_query,
+                                                           DocumentStatus document_status,
+                                                           size_t top_k) const {
+    const auto index = GetSnapshot();
+    Query query = ParseQuery(*index, raw_query);
+
+    const ResultCache::Key key{query.plus_terms, query.minus_terms, document_status, top_k};
+    if (auto documents = result_cache_.Find(key, index->epoch)) {
+        return std::move(*documents);
+    }
+
+    ComputeIdfs(*index, query);
+    const auto predicate = [document_status](int document_id, DocumentStatus status, int rating) {
+        return status == document_status;
+    };
+
+    std::vector<Document> documents;
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+        documents = SelectTopDocuments(*index, query, predicate, top_k);
+    } else {
+        documents = SelectTopDocumentsParallel(*index, query, predicate, top_k);
+    }
+
+    result_cache_.Insert(key, index->epoch, documents);
+    return documents;
+}
+
+template <typename ExecutionPolicy, typename>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(
+    ExecutionPolicy&& policy, std::string_view raw_query, int document_id) const {
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+        return MatchDocument(raw_query, document_id);
+    } else {
+        const auto index = GetSnapshot();
+        const auto location = FindDocument(*index, document_id);
+        if (!location) {
+            throw std::out_of_range("document not found");
+        }
+        const auto [segment, ordinal] = *location;
+
+        const Query query = ParseQuery(*index, raw_query);
+
+        const auto contains = [segment = segment, ordinal = ordinal](int term_id) {
+            return segment->ContainsTerm(ordinal, term_id);
+        };
+
+        if (std::any_of(policy, query.minus_terms.begin(), query.minus_terms.end(), contains)) {
+            return {std::vector<std::string_view>(), segment->document_status[ordinal]};
+        }
+
+        std::vector<int> matched_terms(query.plus_terms.size());
+        matched_terms.erase(std::copy_if(policy, query.plus_terms.begin(), query.plus_terms.end(),
+                                         matched_terms.begin(), contains),
+                            matched_terms.end());
+
+        std::vector<std::string_view> words(matched_terms.size());
+        std::transform(policy, matched_terms.begin(), matched_terms.end(), words.begin(),
+                       [this](int term_id) { return terms_.GetTerm(term_id); });
+        std::sort(policy, words.begin(), words.end());
+
+        return {words, segment->document_status[ordinal]};
+    }
+}
+
+template <typename Predicate>
+std::vector<Document> SearchServer::FindAllDocuments(const SegmentVersion& version,
+                                                     const Query& query, Predicate predicate,
+                                                     int first_ordinal, int last_ordinal) const {
+    const IndexSegment& segment = *version.segment;
+    // The accumulator is indexed by the offset of the ordinal in the range.
+    PooledScoreAccumulator accumulator(last_ordinal - first_ordinal);
+
+    using Cursor = PostingList::Cursor;
+
+    for (int term_id : query.minus_terms) {
+        const PostingList::Image postings = segment.FindPostings(term_id);
+        if (postings.size == 0) {
+            continue;
+        }
+        Cursor cursor(postings);
+        for (cursor.Seek(first_ordinal); cursor.Ordinal() < last_ordinal; cursor.Next()) {
+            accumulator->Exclude(cursor.Ordinal() - first_ordinal);
+        }
+    }
+
+    for (size_t i = 0; i < query.plus_terms.size(); ++i) {
+        const PostingList::Image postings = segment.FindPostings(query.plus_terms[i]);
+        if (postings.size == 0) {
             continue;
         }
-        for (const auto& [id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(id);
+        const double idf = query.plus_idfs[i];
+        Cursor cursor(postings);
+        for (cursor.Seek(first_ordinal); cursor.Ordinal() < last_ordinal; cursor.Next()) {
+            const int ordinal = cursor.Ordinal();
+            if (accumulator->IsExcluded(ordinal - first_ordinal) || version.IsRemoved(ordinal)) {
+                continue;
+            }
+            if (predicate(segment.document_ids[ordinal], segment.document_status[ordinal],
+                          segment.document_ratings[ordinal])) {
+                accumulator->Add(ordinal - first_ordinal,
+                                 segment.GetTermFreq(ordinal, cursor.TermCount()) * idf);
+            }
         }
     }
 
     std::vector<Document> matched_documents;
 
-    for (const auto& [id, relevance] : document_to_relevance) {
-        auto rating = document_ratings_.at(id);
+    accumulator->ForEachScored([&](int offset, double relevance) {
+        const int ordinal = first_ordinal + offset;
+        matched_documents.push_back(
+            {segment.document_ids[ordinal], relevance, segment.document_ratings[ordinal]});
+    });
+
+    return matched_documents;
+}
+
+template <typename Predicate>
+void SearchServer::FindTopDocumentsWithPruning(const SegmentVersion& version, const Query& query,
+                                               Predicate predicate,
+                                               DocumentSelector& selector) const {
+    const IndexSegment& segment = *version.segment;
+    using Cursor = PostingList::Cursor;
+
+    struct TermCursor {
+        Cursor cursor;
+        double idf;
+        double max_score;
+        size_t term_index;
+    };
 
-        matched_documents.push_back({id, relevance, rating});
+    std::vector<TermCursor> terms;
+    terms.reserve(query.plus_terms.size());
+    for (size_t i = 0; i < query.plus_terms.size(); ++i) {
+        const PostingList::Image postings = segment.FindPostings(query.plus_terms[i]);
+        if (postings.size == 0) {
+            continue;
+        }
+        const double idf = query.plus_idfs[i];
+        terms.push_back({Cursor(postings), idf, postings.max_term_freq * idf, i});
     }
 
-    return matched_documents;
+    std::vector<Cursor> minus_cursors;
+    for (int term_id : query.minus_terms) {
+        const PostingList::Image postings = segment.FindPostings(term_id);
+        if (postings.size > 0) {
+            minus_cursors.emplace_back(postings);
+        }
+    }
+    // Cursors hold a decoded block each, so they are reordered by pointer.
+    std::vector<TermCursor*> order;
+    for (TermCursor& term : terms) {
+        order.push_back(&term);
+    }
+
+    const auto by_ordinal = [](const TermCursor* lhs, const TermCursor* rhs) {
+        return lhs->cursor.Ordinal() < rhs->cursor.Ordinal();
+    };
+    const auto by_term = [](const TermCursor* lhs, const TermCursor* rhs) {
+        return lhs->term_index < rhs->term_index;
+    };
+
+    while (true) {
+        // A document can enter a full selector only if it is not EPSILON-worse
+        // than the worst kept one; the extra EPSILON absorbs rounding of bounds.
+        const double threshold = selector.IsFull()
+                                     ? selector.Worst().relevance - 2 * EPSILON
+                                     : -std::numeric_limits<double>::infinity();
+
+        std::sort(order.begin(), order.end(), by_ordinal);
+
+        size_t pivot = 0;
+        double upper_bound = 0.0;
+        for (; pivot < order.size(); ++pivot) {
+            upper_bound += order[pivot]->max_score;
+            if (upper_bound > threshold) {
+                break;
+            }
+        }
+        if (pivot == order.size() || order[pivot]->cursor.Ordinal() == Cursor::END) {
+            break;
+        }
+
+        const int pivot_ordinal = order[pivot]->cursor.Ordinal();
+        while (pivot + 1 < order.size() && order[pivot + 1]->cursor.Ordinal() == pivot_ordinal) {
+            ++pivot;
+        }
+
+        double block_bound = 0.0;
+        int next_ordinal = pivot + 1 < order.size() ? order[pivot + 1]->cursor.Ordinal()
+                                                    : Cursor::END;
+        for (size_t i = 0; i <= pivot; ++i) {
+            const auto block = order[i]->cursor.GetBlockBound(pivot_ordinal);
+            block_bound += block.max_term_freq * order[i]->idf;
+            if (block.last_ordinal < next_ordinal) {
+                next_ordinal = block.last_ordinal + 1;
+            }
+        }
+
+        if (block_bound <= threshold) {
+            for (size_t i = 0; i <= pivot; ++i) {
+                order[i]->cursor.Seek(next_ordinal);
+            }
+            continue;
+        }
+
+        if (order[0]->cursor.Ordinal() != pivot_ordinal) {
+            for (size_t i = 0; i < pivot; ++i) {
+                order[i]->cursor.Seek(pivot_ordinal);
+            }
+            continue;
+        }
+
+        bool excluded = false;
+        for (Cursor& cursor : minus_cursors) {
+            cursor.Seek(pivot_ordinal);
+            excluded = excluded || cursor.Ordinal() == pivot_ordinal;
+        }
+
+        const int ordinal = pivot_ordinal;
+        if (!excluded && !version.IsRemoved(ordinal) &&
+            predicate(segment.document_ids[ordinal],
+                      segment.document_status[ordinal],
+                      segment.document_ratings[ordinal])) {
+            // Sum in query term order, exactly as FindAllDocuments does.
+            std::sort(order.begin(), order.begin() + pivot + 1, by_term);
+            double relevance = 0.0;
+            for (size_t i = 0; i <= pivot; ++i) {
+                relevance +=
+                    segment.GetTermFreq(ordinal, order[i]->cursor.TermCount()) * order[i]->idf;
+            }
+            selector.Push(
+                {segment.document_ids[ordinal], relevance, segment.document_ratings[ordinal]});
+        }
+
+        for (size_t i = 0; i <= pivot; ++i) {
+            order[i]->cursor.Next();
+        }
+    }
 }
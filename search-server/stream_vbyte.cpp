@@ -0,0 +1,130 @@
+#include "stream_vbyte.h"
+
+#include <array>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAM_VBYTE_X86
+#endif
+
+using namespace std;
+
+namespace {
+
+struct DecodeTables {
+    array<uint8_t, 256> lengths;
+    array<array<uint8_t, 16>, 256> shuffles;
+};
+
+// For every control byte: total data length of its four values and the
+// shuffle mask that spreads those bytes into four little-endian uint32s.
+const DecodeTables& GetDecodeTables() {
+    static const DecodeTables tables = [] {
+        DecodeTables result;
+        for (int control = 0; control < 256; ++control) {
+            uint8_t offset = 0;
+            for (int i = 0; i < 4; ++i) {
+                const int length = ((control >> (2 * i)) & 3) + 1;
+                for (int byte = 0; byte < 4; ++byte) {
+                    result.shuffles[control][4 * i + byte] =
+                        byte < length ? offset + byte : 0x80;
+                }
+                offset += length;
+            }
+            result.lengths[control] = offset;
+        }
+        return result;
+    }();
+    return tables;
+}
+
+int ByteLength(uint32_t value) {
+    if (value < (1u << 8)) {
+        return 1;
+    }
+    if (value < (1u << 16)) {
+        return 2;
+    }
+    if (value < (1u << 24)) {
+        return 3;
+    }
+    return 4;
+}
+
+// Decodes values [first, count) whose data starts at the given pointer.
+const uint8_t* DecodeScalar(const uint8_t* control, const uint8_t* data, size_t first,
+                            size_t count, uint32_t* values) {
+    for (size_t i = first; i < count; ++i) {
+        const int length = ((control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        uint32_t value = 0;
+        for (int byte = 0; byte < length; ++byte) {
+            value |= static_cast<uint32_t>(data[byte]) << (8 * byte);
+        }
+        values[i] = value;
+        data += length;
+    }
+    return data;
+}
+
+#ifdef STREAM_VBYTE_X86
+__attribute__((target("ssse3"))) const uint8_t* DecodeSsse3(const uint8_t* in, size_t count,
+                                                            uint32_t* values) {
+    const DecodeTables& tables = GetDecodeTables();
+    const uint8_t* control = in;
+    const uint8_t* data = in + (count + 3) / 4;
+
+    const size_t full_groups = count / 4;
+    for (size_t group = 0; group < full_groups; ++group) {
+        const uint8_t key = control[group];
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        const __m128i mask =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.shuffles[key].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + 4 * group),
+                         _mm_shuffle_epi8(bytes, mask));
+        data += tables.lengths[key];
+    }
+
+    return DecodeScalar(control, data, full_groups * 4, count, values);
+}
+
+bool HasSsse3() {
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    return has_ssse3;
+}
+#endif
+
+}  // namespace
+
+void EncodeStreamVByte(const uint32_t* values, size_t count, vector<uint8_t>& out) {
+    const size_t control_start = out.size();
+    out.resize(control_start + (count + 3) / 4, 0);
+
+    for (size_t i = 0; i < count; ++i) {
+        const int length = ByteLength(values[i]);
+        out[control_start + i / 4] |= static_cast<uint8_t>((length - 1) << (2 * (i % 4)));
+        for (int byte = 0; byte < length; ++byte) {
+            out.push_back(static_cast<uint8_t>(values[i] >> (8 * byte)));
+        }
+    }
+}
+
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* values) {
+#ifdef STREAM_VBYTE_X86
+    if (HasSsse3()) {
+        return DecodeSsse3(in, count, values);
+    }
+#endif
+    return DecodeScalar(in, in + (count + 3) / 4, 0, count, values);
+}
+
+size_t GetStreamVByteLength(const uint8_t* in, size_t count) {
+    const DecodeTables& tables = GetDecodeTables();
+    size_t length = (count + 3) / 4;
+    for (size_t group = 0; group < count / 4; ++group) {
+        length += tables.lengths[in[group]];
+    }
+    for (size_t i = count / 4 * 4; i < count; ++i) {
+        length += ((in[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    }
+    return length;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// StreamVByte integer codec: a control byte holds the byte lengths (1-4) of
+// four values, and the values' significant bytes follow all control bytes.
+// The layout lets a decoder expand four values with a single byte shuffle.
+
+// Number of bytes the decoder may read past the end of the encoded data.
+const size_t STREAM_VBYTE_PADDING = 16;
+
+void EncodeStreamVByte(const uint32_t* values, size_t count, std::vector<uint8_t>& out);
+
+// Decodes count values. Uses SSSE3 when the CPU supports it and falls back
+// to scalar code otherwise. Returns a pointer past the encoded data.
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* values);
+
+// Length of the encoding of count values that starts at in, which holds at
+// least the (count + 3) / 4 control bytes; only those are read. Lets a
+// reader check that untrusted data holds the values before decoding them.
+size_t GetStreamVByteLength(const uint8_t* in, size_t count);
@@ -1,23 +1,137 @@
 #include "string_processing.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STRING_PROCESSING_X86
+#endif
+
 using namespace std;
 
-vector<string> SplitIntoWords(const string& text) {
-    vector<string> words;
-    string word;
-    for (const char c : text) {
+namespace {
+
+// State of a scan: where the current word starts and the position of the
+// first control character, if any.
+struct Scan {
+    size_t word_start = 0;
+    size_t invalid = string_view::npos;
+};
+
+void AddWord(string_view text, size_t end, Scan& scan, vector<string_view>& words) {
+    if (scan.word_start < end) {
+        words.push_back(text.substr(scan.word_start, end - scan.word_start));
+    }
+    scan.word_start = end + 1;
+}
+
+// Handles a chunk starting at position from the masks of its spaces and
+// control characters, one bit per byte.
+void AddChunk(string_view text, size_t position, uint32_t spaces, uint32_t controls, Scan& scan,
+              vector<string_view>& words) {
+    if (controls != 0 && scan.invalid == string_view::npos) {
+        scan.invalid = position + __builtin_ctz(controls);
+    }
+    for (; spaces != 0; spaces &= spaces - 1) {
+        AddWord(text, position + __builtin_ctz(spaces), scan, words);
+    }
+}
+
+void ScanScalar(string_view text, size_t position, Scan& scan, vector<string_view>& words) {
+    for (; position < text.size(); ++position) {
+        const auto c = static_cast<unsigned char>(text[position]);
         if (c == ' ') {
-            if (!word.empty()) {
-                words.push_back(word);
-                word.clear();
-            }
-        } else {
-            word += c;
+            AddWord(text, position, scan, words);
+        } else if (c < ' ' && scan.invalid == string_view::npos) {
+            scan.invalid = position;
         }
     }
-    if (!word.empty()) {
-        words.push_back(word);
+}
+
+#ifdef STRING_PROCESSING_X86
+// The vector versions compare 16 or 32 bytes at a time and return the
+// position of the first byte they have not scanned.
+
+__attribute__((target("sse2"))) size_t ScanSse2(string_view text, Scan& scan,
+                                                 vector<string_view>& words) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+
+    size_t position = 0;
+    for (; position + 16 <= text.size(); position += 16) {
+        const __m128i bytes =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + position));
+        // Unsigned bytes up to ' ' - 1 are left unchanged by the minimum.
+        const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_control), bytes);
+        AddChunk(text, position, _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)),
+                 _mm_movemask_epi8(controls), scan, words);
     }
+    return position;
+}
 
+__attribute__((target("avx2"))) size_t ScanAvx2(string_view text, Scan& scan,
+                                                vector<string_view>& words) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i last_control = _mm256_set1_epi8(' ' - 1);
+
+    size_t position = 0;
+    for (; position + 32 <= text.size(); position += 32) {
+        const __m256i bytes =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + position));
+        const __m256i controls =
+            _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last_control), bytes);
+        AddChunk(text, position, _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, space)),
+                 _mm256_movemask_epi8(controls), scan, words);
+    }
+    return position;
+}
+
+bool HasSse2() {
+    static const bool has_sse2 = __builtin_cpu_supports("sse2");
+    return has_sse2;
+}
+
+bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+Scan ScanWords(string_view text, vector<string_view>& words) {
+    Scan scan;
+    size_t position = 0;
+#ifdef STRING_PROCESSING_X86
+    if (HasAvx2()) {
+        position = ScanAvx2(text, scan, words);
+    } else if (HasSse2()) {
+        position = ScanSse2(text, scan, words);
+    }
+#endif
+    ScanScalar(text, position, scan, words);
+    AddWord(text, text.size(), scan, words);
+    return scan;
+}
+
+}  // namespace
+
+vector<string_view> SplitIntoWords(string_view text) {
+    vector<string_view> words;
+    ScanWords(text, words);
+    return words;
+}
+
+vector<string_view> SplitIntoValidWords(string_view text) {
+    vector<string_view> words;
+    const Scan scan = ScanWords(text, words);
+    if (scan.invalid != string_view::npos) {
+        // Control characters are not separators, so one of the words holds it.
+        const auto word = partition_point(words.begin(), words.end(), [&](string_view word) {
+            return static_cast<size_t>(word.data() + word.size() - text.data()) <= scan.invalid;
+        });
+        throw invalid_argument("word is invalid: " + string(*word));
+    }
     return words;
-}
\ No newline at end of file
+}
@@ -1,6 +1,12 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 #include <vector>
 
-std::vector<std::string> SplitIntoWords(const std::string& text);
\ No newline at end of file
+// Splits text at spaces into views of the text; empty words are skipped.
+std::vector<std::string_view> SplitIntoWords(std::string_view text);
+
+// Same as SplitIntoWords, but also checks in the same pass that no word
+// holds a control character [0, 32). Throws std::invalid_argument naming
+// the first word that does.
+std::vector<std::string_view> SplitIntoValidWords(std::string_view text);
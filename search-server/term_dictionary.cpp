@@ -0,0 +1,56 @@
+#include "term_dictionary.h"
+
+#include <mutex>
+#include <utility>
+
+using namespace std;
+
+int TermDictionary::Intern(string_view term) {
+    if (const auto term_id = Find(term)) {
+        return *term_id;
+    }
+
+    unique_lock lock(mutex_);
+    if (auto it = term_ids_.find(term); it != term_ids_.end()) {
+        return it->second;
+    }
+
+    const int term_id = static_cast<int>(terms_.size());
+    terms_.push_back(owned_terms_.emplace_back(term));
+    term_ids_.emplace(terms_.back(), term_id);
+
+    return term_id;
+}
+
+bool TermDictionary::InternViews(const vector<string_view>& terms,
+                                 shared_ptr<const void> storage) {
+    unique_lock lock(mutex_);
+    storage_ = move(storage);
+    terms_.reserve(terms_.size() + terms.size());
+    term_ids_.reserve(term_ids_.size() + terms.size());
+    for (string_view term : terms) {
+        if (!term_ids_.emplace(term, static_cast<int>(terms_.size())).second) {
+            return false;
+        }
+        terms_.push_back(term);
+    }
+    return true;
+}
+
+optional<int> TermDictionary::Find(string_view term) const {
+    shared_lock lock(mutex_);
+    if (auto it = term_ids_.find(term); it != term_ids_.end()) {
+        return it->second;
+    }
+    return nullopt;
+}
+
+string_view TermDictionary::GetTerm(int term_id) const {
+    shared_lock lock(mutex_);
+    return terms_.at(term_id);
+}
+
+size_t TermDictionary::size() const {
+    shared_lock lock(mutex_);
+    return terms_.size();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Interns every distinct word once and gives it a dense integer id.
+// Returned string_views stay valid for the lifetime of the dictionary.
+// Safe to use from several threads: lookups take a shared lock, interning a
+// new word takes an exclusive one.
+class TermDictionary {
+   public:
+    int Intern(std::string_view term);
+
+    // Interns the terms of an empty dictionary as ids 0, 1, ... without
+    // copying them; storage keeps them alive. Returns false if a term
+    // repeats.
+    bool InternViews(const std::vector<std::string_view>& terms,
+                     std::shared_ptr<const void> storage);
+
+    std::optional<int> Find(std::string_view term) const;
+
+    std::string_view GetTerm(int term_id) const;
+
+    size_t size() const;
+
+   private:
+    mutable std::shared_mutex mutex_;
+    // Terms added by Intern; terms_ also views terms kept alive by storage_.
+    std::deque<std::string> owned_terms_;
+    std::shared_ptr<const void> storage_;
+    std::vector<std::string_view> terms_;
+    std::unordered_map<std::string_view, int> term_ids_;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Keeps the k best of the pushed values in a heap whose front is the worst
+// kept value, so pushing n values costs O(n log k) instead of a full sort.
+template <typename T, typename Better>
+class TopKSelector {
+   public:
+    TopKSelector(size_t k, Better better) : k_(k), better_(better) {
+        heap_.reserve(k);
+    }
+
+    void Push(T value) {
+        if (heap_.size() < k_) {
+            heap_.push_back(std::move(value));
+            std::push_heap(heap_.begin(), heap_.end(), better_);
+        } else if (k_ > 0 && better_(value, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), better_);
+            heap_.back() = std::move(value);
+            std::push_heap(heap_.begin(), heap_.end(), better_);
+        }
+    }
+
+    bool IsFull() const { return k_ > 0 && heap_.size() == k_; }
+
+    // The worst of the kept values; only valid when the selector is not empty.
+    const T& Worst() const { return heap_.front(); }
+
+    // Returns the kept values ordered from the best to the worst.
+    std::vector<T> Extract() {
+        std::sort_heap(heap_.begin(), heap_.end(), better_);
+        return std::move(heap_);
+    }
+
+   private:
+    size_t k_;
+    Better better_;
+    std::vector<T> heap_;
+};
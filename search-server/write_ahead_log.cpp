@@ -0,0 +1,385 @@
+#include "write_ahead_log.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "crc32.h"
+#include "file_sync.h"
+
+using namespace std;
+
+namespace {
+
+const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+template <typename T>
+void AppendValue(string& output, T value) {
+    output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+class PayloadReader {
+   public:
+    explicit PayloadReader(string_view payload) : payload_(payload) {}
+
+    template <typename T>
+    T ReadValue() {
+        T value;
+        memcpy(&value, Take(sizeof(value)).data(), sizeof(value));
+        return value;
+    }
+
+    string_view ReadBytes(size_t size) { return Take(size); }
+
+    bool AtEnd() const { return payload_.empty(); }
+
+   private:
+    string_view payload_;
+
+    string_view Take(size_t size) {
+        if (size > payload_.size()) {
+            throw invalid_argument("log record is truncated");
+        }
+        const string_view bytes = payload_.substr(0, size);
+        payload_.remove_prefix(size);
+        return bytes;
+    }
+};
+
+WriteAheadLog::Record ParsePayload(string_view payload) {
+    PayloadReader reader(payload);
+    WriteAheadLog::Record record;
+    record.sequence = reader.ReadValue<uint64_t>();
+    record.type = static_cast<WriteAheadLog::RecordType>(reader.ReadValue<uint8_t>());
+    record.document_id = reader.ReadValue<int32_t>();
+
+    if (record.type == WriteAheadLog::RecordType::ADD) {
+        record.status = static_cast<DocumentStatus>(reader.ReadValue<int32_t>());
+        record.ratings.resize(reader.ReadValue<uint32_t>());
+        for (int& rating : record.ratings) {
+            rating = reader.ReadValue<int32_t>();
+        }
+        record.text = string(reader.ReadBytes(reader.ReadValue<uint32_t>()));
+    } else if (record.type != WriteAheadLog::RecordType::REMOVE) {
+        throw invalid_argument("unknown log record type");
+    }
+
+    if (!reader.AtEnd()) {
+        throw invalid_argument("log record has trailing bytes");
+    }
+    return record;
+}
+
+// Parses the records of the file contents and returns the size of their valid
+// prefix.
+size_t ParseRecords(string_view contents, vector<WriteAheadLog::Record>* records) {
+    size_t valid_size = 0;
+    while (contents.size() - valid_size >= RECORD_HEADER_SIZE) {
+        uint32_t length;
+        uint32_t crc;
+        memcpy(&length, contents.data() + valid_size, sizeof(length));
+        memcpy(&crc, contents.data() + valid_size + sizeof(length), sizeof(crc));
+        if (length > contents.size() - valid_size - RECORD_HEADER_SIZE) {
+            break;
+        }
+
+        const string_view payload = contents.substr(valid_size + RECORD_HEADER_SIZE, length);
+        if (ComputeCrc32(payload) != crc) {
+            break;
+        }
+        try {
+            auto record = ParsePayload(payload);
+            if (records != nullptr) {
+                records->push_back(move(record));
+            }
+        } catch (const invalid_argument&) {
+            break;
+        }
+        valid_size += RECORD_HEADER_SIZE + length;
+    }
+    return valid_size;
+}
+
+string ReadFile(const string& path) {
+    ifstream input(path, ios::binary);
+    return string(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+}
+
+void WriteAll(int descriptor, string_view data) {
+    while (!data.empty()) {
+        const ssize_t written = write(descriptor, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw runtime_error("cannot write to log: "s + strerror(errno));
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+}  // namespace
+
+vector<WriteAheadLog::Record> WriteAheadLog::ReadRecords(const string& path) {
+    vector<Record> records;
+    ParseRecords(ReadFile(path), &records);
+    return records;
+}
+
+WriteAheadLog::WriteAheadLog(const string& path, WriteAheadLogOptions options,
+                             uint64_t last_sequence)
+    : path_(path), options_(options), last_sequence_(last_sequence) {
+    vector<Record> records;
+    const string contents = ReadFile(path);
+    const size_t valid_size = ParseRecords(contents, &records);
+    if (!records.empty()) {
+        last_sequence_ = max(last_sequence_, records.back().sequence);
+    }
+
+    Open();
+    if (valid_size < contents.size() && ftruncate(descriptor_, valid_size) != 0) {
+        close(descriptor_);
+        throw runtime_error("cannot cut off the torn tail of log " + path);
+    }
+    written_size_ = valid_size;
+
+    // Without groups every record is written and synced as it comes.
+    if (options_.max_delay.count() > 0 &&
+        (options_.group_size > 1 || options_.groups_per_sync > 1)) {
+        flusher_ = thread([this] { RunFlusher(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        lock_guard guard(mutex_);
+        stopping_ = true;
+    }
+    flush_condition_.notify_all();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+    try {
+        if (!failed_) {
+            Sync();
+        }
+    } catch (const runtime_error&) {
+    }
+    close(descriptor_);
+}
+
+uint64_t WriteAheadLog::AppendAdd(int document_id, string_view text, DocumentStatus status,
+                                  const vector<int>& ratings) {
+    string fields;
+    AppendValue(fields, static_cast<uint8_t>(RecordType::ADD));
+    AppendValue(fields, static_cast<int32_t>(document_id));
+    AppendValue(fields, static_cast<int32_t>(status));
+    AppendValue(fields, static_cast<uint32_t>(ratings.size()));
+    for (int rating : ratings) {
+        AppendValue(fields, static_cast<int32_t>(rating));
+    }
+    AppendValue(fields, static_cast<uint32_t>(text.size()));
+    fields.append(text);
+    return Append(fields);
+}
+
+uint64_t WriteAheadLog::AppendRemove(int document_id) {
+    string fields;
+    AppendValue(fields, static_cast<uint8_t>(RecordType::REMOVE));
+    AppendValue(fields, static_cast<int32_t>(document_id));
+    return Append(fields);
+}
+
+void WriteAheadLog::Sync() {
+    lock_guard guard(mutex_);
+    SyncLocked();
+}
+
+void WriteAheadLog::SyncLocked() {
+    CheckNotFailed();
+    if (pending_records_ > 0) {
+        WritePending();
+    }
+    if (groups_since_sync_ > 0) {
+        // After a failed fsync the kernel may have dropped the dirty pages,
+        // so a retry could report success for lost records.
+        if (fdatasync(descriptor_) != 0) {
+            Fail(runtime_error("cannot sync log: "s + strerror(errno)));
+        }
+        groups_since_sync_ = 0;
+    }
+}
+
+WriteAheadLog::Position WriteAheadLog::GetEnd() const {
+    lock_guard guard(mutex_);
+    return {last_sequence_, written_size_ + pending_.size(), written_size_, pending_records_};
+}
+
+void WriteAheadLog::RollBack(const Position& position) {
+    lock_guard guard(mutex_);
+    last_sequence_ = position.sequence;
+    if (!failed_ && written_size_ == position.written_size) {
+        // None of the records after the position has been written yet.
+        pending_.resize(position.offset - written_size_);
+        pending_records_ = position.pending_records;
+        return;
+    }
+
+    // The records pending at the position were written together with the
+    // dropped ones and stay.
+    pending_.clear();
+    pending_records_ = 0;
+    if (written_size_ > position.offset) {
+        if (ftruncate(descriptor_, static_cast<off_t>(position.offset)) != 0) {
+            failed_ = true;
+            return;
+        }
+        written_size_ = position.offset;
+    }
+}
+
+void WriteAheadLog::Truncate(uint64_t sequence) {
+    lock_guard guard(mutex_);
+    SyncLocked();
+
+    string kept;
+    const string contents = ReadFile(path_);
+    vector<Record> records;
+    ParseRecords(contents, &records);
+    size_t offset = 0;
+    for (const Record& record : records) {
+        uint32_t length;
+        memcpy(&length, contents.data() + offset, sizeof(length));
+        const size_t size = RECORD_HEADER_SIZE + length;
+        if (record.sequence > sequence) {
+            kept.append(contents, offset, size);
+        }
+        offset += size;
+    }
+
+    // The new file replaces the old one atomically, so a crash leaves one
+    // of them complete.
+    const string temporary_path = path_ + ".tmp";
+    const int descriptor = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (descriptor < 0) {
+        throw runtime_error("cannot create " + temporary_path);
+    }
+    try {
+        WriteAll(descriptor, kept);
+        if (fsync(descriptor) != 0) {
+            throw runtime_error("cannot sync " + temporary_path);
+        }
+    } catch (...) {
+        close(descriptor);
+        throw;
+    }
+    close(descriptor);
+
+    if (rename(temporary_path.c_str(), path_.c_str()) != 0) {
+        throw runtime_error("cannot replace log " + path_);
+    }
+    close(descriptor_);
+    Open();
+    written_size_ = kept.size();
+    // Until the rename is durable a crash can bring the old log back next
+    // to the saved index, and its records would be replayed twice.
+    SyncParentDirectory(path_);
+}
+
+void WriteAheadLog::Open() {
+    descriptor_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (descriptor_ < 0) {
+        throw runtime_error("cannot open log " + path_);
+    }
+}
+
+void WriteAheadLog::CheckNotFailed() const {
+    if (failed_) {
+        throw runtime_error("log " + path_ + " failed earlier and accepts no more writes");
+    }
+}
+
+bool WriteAheadLog::HasUnsynced() const {
+    return pending_records_ > 0 || (options_.groups_per_sync > 0 && groups_since_sync_ > 0);
+}
+
+void WriteAheadLog::RunFlusher() {
+    unique_lock lock(mutex_);
+    while (!stopping_) {
+        if (failed_ || !HasUnsynced()) {
+            flush_condition_.wait(lock);
+            continue;
+        }
+        const auto deadline = oldest_unsynced_ + options_.max_delay;
+        if (chrono::steady_clock::now() < deadline) {
+            flush_condition_.wait_until(lock, deadline);
+            continue;
+        }
+        try {
+            if (options_.groups_per_sync == 0) {
+                WritePending();
+            } else {
+                SyncLocked();
+            }
+        } catch (const runtime_error&) {
+            // The log has failed, and the next call reports it.
+        }
+    }
+}
+
+void WriteAheadLog::Fail(const runtime_error& error) {
+    failed_ = true;
+    pending_.clear();
+    pending_records_ = 0;
+    // Cuts off a partly written group, so that the file ends with a complete
+    // record.
+    if (ftruncate(descriptor_, static_cast<off_t>(written_size_)) != 0) {
+        // Reading stops at the torn record anyway.
+    }
+    throw error;
+}
+
+uint64_t WriteAheadLog::Append(const string& payload_fields) {
+    lock_guard guard(mutex_);
+    CheckNotFailed();
+    const uint64_t sequence = ++last_sequence_;
+    if (!HasUnsynced()) {
+        oldest_unsynced_ = chrono::steady_clock::now();
+        flush_condition_.notify_all();
+    }
+
+    string payload;
+    AppendValue(payload, sequence);
+    payload += payload_fields;
+
+    AppendValue(pending_, static_cast<uint32_t>(payload.size()));
+    AppendValue(pending_, ComputeCrc32(payload));
+    pending_ += payload;
+    ++pending_records_;
+
+    if (pending_records_ >= options_.group_size) {
+        WritePending();
+        if (options_.groups_per_sync > 0 && groups_since_sync_ >= options_.groups_per_sync) {
+            SyncLocked();
+        }
+    }
+    return sequence;
+}
+
+void WriteAheadLog::WritePending() {
+    try {
+        WriteAll(descriptor_, pending_);
+    } catch (const runtime_error& error) {
+        Fail(error);
+    }
+    written_size_ += pending_.size();
+    pending_.clear();
+    pending_records_ = 0;
+    ++groups_since_sync_;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+struct WriteAheadLogOptions {
+    // Pending records are written to the file together once there are this
+    // many of them; 1 writes every record as it comes.
+    size_t group_size = 1;
+    // Written groups between two fsyncs; 0 leaves syncing to the OS.
+    size_t groups_per_sync = 1;
+    // Longest time a record stays pending, or written but not synced, before
+    // a background thread writes and syncs it; 0 waits for the group to fill
+    // or for Sync.
+    std::chrono::milliseconds max_delay{10};
+};
+
+// Append-only log of index changes. Every record is stored as uint32 payload
+// length, uint32 CRC-32 of the payload and the payload: uint64 sequence
+// number, uint8 type and the fields of the change. Records that are only
+// pending are lost on a crash, so group_size and groups_per_sync trade
+// durability for throughput; max_delay bounds how long a record can stay
+// at risk, and Sync makes everything appended durable at once.
+//
+// A failed write or sync puts the log into a failed state: the file is cut
+// back to the end of the last complete group, the pending records are
+// dropped and every further call throws std::runtime_error, because the
+// records that were lost cannot be told apart from the durable ones.
+//
+// Appending and rolling back are serialized by SearchServer's write lock; the
+// log's own mutex only guards against the background flush.
+class WriteAheadLog {
+   public:
+    enum class RecordType : uint8_t { ADD = 1, REMOVE = 2 };
+
+    // End of the records appended so far, to roll back to.
+    struct Position {
+        uint64_t sequence = 0;
+        size_t offset = 0;
+        size_t written_size = 0;
+        size_t pending_records = 0;
+    };
+
+    struct Record {
+        uint64_t sequence = 0;
+        RecordType type = RecordType::ADD;
+        int document_id = 0;
+        // Only set for ADD.
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        std::vector<int> ratings;
+        std::string text;
+    };
+
+    // The valid records of the file, stopping at the first torn or corrupted
+    // one. A missing file has none.
+    static std::vector<Record> ReadRecords(const std::string& path);
+
+    // Opens the log for appending after its last valid record, cutting off a
+    // torn tail. Sequence numbers continue after last_sequence or the last
+    // record of the file, whichever is greater.
+    WriteAheadLog(const std::string& path, WriteAheadLogOptions options, uint64_t last_sequence);
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    ~WriteAheadLog();
+
+    // Each returns the sequence number of the appended record.
+    uint64_t AppendAdd(int document_id, std::string_view text, DocumentStatus status,
+                       const std::vector<int>& ratings);
+
+    uint64_t AppendRemove(int document_id);
+
+    void Sync();
+
+    Position GetEnd() const;
+
+    // Drops the records appended after the position, cutting them off the
+    // file if they are already written, so that a change the caller saw
+    // fail is not replayed. Works in the failed state too; if the file
+    // cannot be cut, the log fails.
+    void RollBack(const Position& position);
+
+    // Drops the records with sequence numbers up to the given one, which are
+    // no longer needed once an index file covering them is saved.
+    void Truncate(uint64_t sequence);
+
+   private:
+    std::string path_;
+    WriteAheadLogOptions options_;
+    mutable std::mutex mutex_;
+    std::condition_variable flush_condition_;
+    // When the oldest record that is not yet durable was appended.
+    std::chrono::steady_clock::time_point oldest_unsynced_;
+    bool stopping_ = false;
+    std::thread flusher_;
+    int descriptor_ = -1;
+    uint64_t last_sequence_ = 0;
+    std::string pending_;
+    size_t pending_records_ = 0;
+    size_t groups_since_sync_ = 0;
+    // End of the last group written completely.
+    size_t written_size_ = 0;
+    bool failed_ = false;
+
+    void Open();
+
+    void CheckNotFailed() const;
+
+    // True if a record is pending, or written but waiting for a sync that
+    // the options ask for.
+    bool HasUnsynced() const;
+
+    // Writes the pending records and syncs the written groups.
+    void SyncLocked();
+
+    // Flushes every record max_delay after it was appended.
+    void RunFlusher();
+
+    // Puts the log into the failed state and throws the error.
+    [[noreturn]] void Fail(const std::runtime_error& error);
+
+    uint64_t Append(const std::string& payload_fields);
+
+    void WritePending();
+};
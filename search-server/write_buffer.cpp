@@ -0,0 +1,113 @@
+#include "write_buffer.h"
+
+#include <algorithm>
+
+#include "index_segment.h"
+
+using namespace std;
+
+namespace {
+
+constexpr size_t INITIAL_TABLE_CAPACITY = 64;
+
+}  // namespace
+
+WriteBuffer::WriteBuffer() {
+    table_.store(tables_.emplace_back(make_unique<Table>(INITIAL_TABLE_CAPACITY)).get(),
+                 memory_order_release);
+    forward_offsets_.PushBack(0);
+}
+
+void WriteBuffer::AddDocument(int document_id, DocumentStatus status, int rating,
+                              vector<int> term_ids) {
+    const int ordinal = GetDocumentCount();
+    const auto length = static_cast<int>(term_ids.size());
+
+    for (const TermCount& term : CountTerms(move(term_ids))) {
+        const double term_freq = term.count / static_cast<double>(length);
+        TermPostings& postings = GetTermPostings(term.term_id);
+        const auto previous = postings.bounds.GetView();
+        postings.ordinals.PushBack(ordinal);
+        postings.counts.PushBack(term.count);
+        postings.bounds.PushBack(
+            {ordinal, previous.empty() ? term_freq : max(previous.back().max_term_freq, term_freq)});
+        forward_terms_.PushBack(term.term_id);
+        forward_counts_.PushBack(term.count);
+    }
+    forward_offsets_.PushBack(forward_terms_.size());
+    word_frequencies_.PushBack(make_shared<const DocumentWordFrequencies>());
+
+    document_ratings_.PushBack(rating);
+    document_status_.PushBack(status);
+    document_lengths_.PushBack(length);
+    // Last, as GetDocumentCount counts the ids.
+    document_ids_.PushBack(document_id);
+}
+
+PostingList::Image WriteBuffer::FindPostings(int term_id, int document_count) const {
+    const Table* table = table_.load(memory_order_acquire);
+    const Slot& slot = table->slots[GetSlot(*table, term_id)];
+    if (slot.term_id.load(memory_order_acquire) == EMPTY_SLOT) {
+        return {};
+    }
+    return GetImage(*slot.postings, document_count);
+}
+
+size_t WriteBuffer::GetSlot(const Table& table, int term_id) {
+    // Fibonacci hashing spreads the dense term ids over the table.
+    size_t slot = static_cast<size_t>(static_cast<uint32_t>(term_id) * 0x9E3779B9u) & table.mask;
+    while (true) {
+        const int slot_term_id = table.slots[slot].term_id.load(memory_order_acquire);
+        if (slot_term_id == term_id || slot_term_id == EMPTY_SLOT) {
+            return slot;
+        }
+        slot = (slot + 1) & table.mask;
+    }
+}
+
+PostingList::Image WriteBuffer::GetImage(const TermPostings& postings, int document_count) {
+    // Postings appended after the view was published have larger ordinals.
+    const auto ordinals = postings.ordinals.GetView();
+    const size_t size =
+        lower_bound(ordinals.begin(), ordinals.end(), document_count) - ordinals.begin();
+    if (size == 0) {
+        return {};
+    }
+
+    PostingList::Image image;
+    image.size = size;
+    image.tail_ordinals = ArrayView<int>(ordinals.data(), size);
+    image.tail_counts = postings.counts.GetView(size);
+    image.blocks = ArrayView<PostingList::BlockBound>(&postings.bounds.GetView(size).back(), 1);
+    image.max_term_freq = image.blocks[0].max_term_freq;
+    return image;
+}
+
+WriteBuffer::TermPostings& WriteBuffer::GetTermPostings(int term_id) {
+    Table* table = table_.load(memory_order_relaxed);
+    size_t slot = GetSlot(*table, term_id);
+    if (table->slots[slot].term_id.load(memory_order_relaxed) == term_id) {
+        return *table->slots[slot].postings;
+    }
+
+    // Kept at most half full, so probe sequences stay short.
+    if (2 * (term_postings_.size() + 1) > table->mask + 1) {
+        auto grown = make_unique<Table>(2 * (table->mask + 1));
+        for (size_t i = 0; i <= table->mask; ++i) {
+            const int slot_term_id = table->slots[i].term_id.load(memory_order_relaxed);
+            if (slot_term_id != EMPTY_SLOT) {
+                Slot& grown_slot = grown->slots[GetSlot(*grown, slot_term_id)];
+                grown_slot.postings = table->slots[i].postings;
+                grown_slot.term_id.store(slot_term_id, memory_order_relaxed);
+            }
+        }
+        table = tables_.emplace_back(move(grown)).get();
+        table_.store(table, memory_order_release);
+        slot = GetSlot(*table, term_id);
+    }
+
+    TermPostings& postings = term_postings_.emplace_back();
+    table->slots[slot].postings = &postings;
+    table->slots[slot].term_id.store(term_id, memory_order_release);
+    return postings;
+}
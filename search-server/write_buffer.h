@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "array_view.h"
+#include "document.h"
+#include "posting_list.h"
+
+class DocumentWordFrequencies;
+
+// Array that one thread appends to while others read the items appended
+// before. A full array moves into a block of twice the size, and the old
+// blocks are kept until the array is destroyed, so a view stays valid while
+// the array grows.
+template <typename T>
+class AppendOnlyArray {
+   public:
+    AppendOnlyArray() = default;
+
+    AppendOnlyArray(const AppendOnlyArray&) = delete;
+
+    AppendOnlyArray& operator=(const AppendOnlyArray&) = delete;
+
+    // Only the appending thread may call it.
+    void PushBack(T value) {
+        const size_t size = size_.load(std::memory_order_relaxed);
+        T* data = data_.load(std::memory_order_relaxed);
+        if (size == capacity_) {
+            capacity_ = std::max<size_t>(2 * capacity_, MIN_CAPACITY);
+            auto& block = blocks_.emplace_back(std::make_unique<T[]>(capacity_));
+            std::copy(data, data + size, block.get());
+            data = block.get();
+            data_.store(data, std::memory_order_release);
+        }
+        data[size] = std::move(value);
+        size_.store(size + 1, std::memory_order_release);
+    }
+
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+
+    // The first items, all of which must have been appended before the
+    // caller learned their count. The block is loaded after the count, so
+    // it holds them even if the array has grown since.
+    ArrayView<T> GetView(size_t size) const {
+        return {data_.load(std::memory_order_acquire), size};
+    }
+
+    ArrayView<T> GetView() const { return GetView(size()); }
+
+   private:
+    static constexpr size_t MIN_CAPACITY = 4;
+
+    std::atomic<size_t> size_{0};
+    std::atomic<T*> data_{nullptr};
+    size_t capacity_ = 0;
+    std::vector<std::unique_ptr<T[]>> blocks_;
+};
+
+// The documents added since the write buffer was last sealed, stored so that
+// adding one only appends to arrays and publishing the buffer to queries
+// copies nothing. Every generation of the index reads the buffer through a
+// view limited to the documents it was published with; postings of later
+// documents have larger ordinals, so the view of a posting list is a prefix
+// of it. One writer adds documents while any number of views are read.
+class WriteBuffer {
+   public:
+    WriteBuffer();
+
+    WriteBuffer(const WriteBuffer&) = delete;
+
+    WriteBuffer& operator=(const WriteBuffer&) = delete;
+
+    // Appends a document given by the term ids of its words, in
+    // O(document length). Only the writer may call it and the functions
+    // below.
+    void AddDocument(int document_id, DocumentStatus status, int rating,
+                     std::vector<int> term_ids);
+
+    int GetDocumentCount() const { return static_cast<int>(document_ids_.size()); }
+
+    // Columns of the documents added so far, for a view to read.
+    ArrayView<int> GetDocumentIds() const { return document_ids_.GetView(); }
+    ArrayView<int> GetDocumentRatings() const { return document_ratings_.GetView(); }
+    ArrayView<DocumentStatus> GetDocumentStatus() const { return document_status_.GetView(); }
+    ArrayView<int> GetDocumentLengths() const { return document_lengths_.GetView(); }
+    ArrayView<size_t> GetForwardOffsets() const { return forward_offsets_.GetView(); }
+    ArrayView<int> GetForwardTerms() const { return forward_terms_.GetView(); }
+    ArrayView<uint32_t> GetForwardCounts() const { return forward_counts_.GetView(); }
+    ArrayView<std::shared_ptr<const DocumentWordFrequencies>> GetWordFrequencies() const {
+        return word_frequencies_.GetView();
+    }
+
+    // Postings of the term in the first document_count documents; the image
+    // is empty if the term does not occur there. Safe to call while the
+    // writer adds documents, if document_count was published before.
+    PostingList::Image FindPostings(int term_id, int document_count) const;
+
+    // Calls function(term_id, image) for every term occurring in the first
+    // document_count documents, in no particular order. Safe to call while
+    // the writer adds documents, like FindPostings.
+    template <typename Function>
+    void ForEachPostings(int document_count, Function function) const {
+        const Table* table = table_.load(std::memory_order_acquire);
+        for (size_t i = 0; i <= table->mask; ++i) {
+            const int term_id = table->slots[i].term_id.load(std::memory_order_acquire);
+            if (term_id != EMPTY_SLOT) {
+                const PostingList::Image image =
+                    GetImage(*table->slots[i].postings, document_count);
+                if (image.size > 0) {
+                    function(term_id, image);
+                }
+            }
+        }
+    }
+
+   private:
+    static constexpr int EMPTY_SLOT = -1;
+
+    struct TermPostings {
+        AppendOnlyArray<int> ordinals;
+        AppendOnlyArray<uint32_t> counts;
+        // Bound of the postings up to each one, so that the bound of a
+        // prefix is at hand for its image.
+        AppendOnlyArray<PostingList::BlockBound> bounds;
+    };
+
+    // Open addressing over term ids. A slot is published by storing its term
+    // id last; slots are never emptied. A table that fills up is replaced by
+    // one twice the size and kept until the buffer is destroyed.
+    struct Slot {
+        std::atomic<int> term_id{EMPTY_SLOT};
+        TermPostings* postings = nullptr;
+    };
+
+    struct Table {
+        explicit Table(size_t capacity)
+            : slots(std::make_unique<Slot[]>(capacity)), mask(capacity - 1) {}
+
+        std::unique_ptr<Slot[]> slots;
+        size_t mask;
+    };
+
+    std::deque<TermPostings> term_postings_;
+    std::vector<std::unique_ptr<Table>> tables_;
+    std::atomic<Table*> table_{nullptr};
+
+    AppendOnlyArray<size_t> forward_offsets_;
+    AppendOnlyArray<int> forward_terms_;
+    AppendOnlyArray<uint32_t> forward_counts_;
+    AppendOnlyArray<std::shared_ptr<const DocumentWordFrequencies>> word_frequencies_;
+
+    AppendOnlyArray<int> document_ids_;
+    AppendOnlyArray<int> document_ratings_;
+    AppendOnlyArray<DocumentStatus> document_status_;
+    AppendOnlyArray<int> document_lengths_;
+
+    static size_t GetSlot(const Table& table, int term_id);
+
+    static PostingList::Image GetImage(const TermPostings& postings, int document_count);
+
+    // Finds the postings of the term, adding them if the term is new.
+    TermPostings& GetTermPostings(int term_id);
+};